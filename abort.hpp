@@ -0,0 +1,218 @@
+#include "slab.hpp"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <utility>
+
+#pragma once
+
+namespace dot
+{
+
+// The exception futures fail with when the work behind them was aborted.
+struct abort_requested : public std::exception
+{
+	virtual const char* what() const noexcept override
+	{
+		return "abort requested";
+	}
+};
+
+
+// Something to do when an abort is requested. on_abort() runs at most once,
+// on the thread requesting the abort, unless the subscription was withdrawn
+// before.
+struct abort_subscription
+{
+	virtual ~abort_subscription() {};
+	virtual void on_abort() noexcept = 0;
+
+	abort_subscription* prev_{nullptr};
+	abort_subscription* next_{nullptr};
+};
+
+
+// State shared by an abort_source and its tokens: the flag and an intrusive
+// list of subscriptions, which the abort takes over as a whole.
+class abort_state : public pooled
+{
+private:
+	std::atomic<bool> requested_{false};
+	std::atomic<uint32_t> refs_{1};
+	std::mutex lock_;
+	abort_subscription* head_{nullptr};
+
+public:
+	void add_ref() noexcept
+	{
+		refs_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release() noexcept
+	{
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	bool requested() const noexcept
+	{
+		return requested_.load(std::memory_order_acquire);
+	}
+
+	// Links `s` in; fails if the abort was requested already.
+	bool subscribe(abort_subscription* s) noexcept
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (requested_.load(std::memory_order_relaxed))
+			return false;
+		s->prev_ = nullptr;
+		s->next_ = head_;
+		if (head_)
+			head_->prev_ = s;
+		head_ = s;
+		return true;
+	}
+
+	// Unlinks `s`; fails if the abort took it already, in which case its
+	// on_abort() runs or has run.
+	bool unsubscribe(abort_subscription* s) noexcept
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (requested_.load(std::memory_order_relaxed))
+			return false;
+		if (s->prev_)
+			s->prev_->next_ = s->next_;
+		else
+			head_ = s->next_;
+		if (s->next_)
+			s->next_->prev_ = s->prev_;
+		return true;
+	}
+
+	void request_abort() noexcept
+	{
+		abort_subscription* s;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			if (requested_.load(std::memory_order_relaxed))
+				return;
+			requested_.store(true, std::memory_order_release);
+			s = std::exchange(head_, nullptr);
+		}
+		while (s)
+		{
+			// on_abort() may free the subscription
+			auto next = s->next_;
+			s->on_abort();
+			s = next;
+		}
+	}
+};
+
+
+// Lets work check for, and subscribe to, the abort of one abort_source.
+// Tokens are cheap to copy; a default constructed one is never aborted.
+class abort_token
+{
+private:
+	abort_state* state_{nullptr};
+
+public:
+	abort_token() noexcept {}
+
+	explicit abort_token(abort_state* s) noexcept
+		: state_(s)
+	{
+		if (state_)
+			state_->add_ref();
+	}
+
+	abort_token(const abort_token& x) noexcept
+		: abort_token(x.state_)
+	{}
+
+	abort_token(abort_token&& x) noexcept
+		: state_(std::exchange(x.state_, nullptr))
+	{}
+
+	~abort_token()
+	{
+		if (state_)
+			state_->release();
+	}
+
+	abort_token& operator=(abort_token x) noexcept
+	{
+		std::swap(state_, x.state_);
+		return *this;
+	}
+
+	bool requested() const noexcept
+	{
+		return state_ && state_->requested();
+	}
+
+	bool subscribe(abort_subscription* s) const noexcept
+	{
+		return !state_ || state_->subscribe(s);
+	}
+
+	bool unsubscribe(abort_subscription* s) const noexcept
+	{
+		return !state_ || state_->unsubscribe(s);
+	}
+};
+
+
+// Requests the abort of all work holding one of its tokens, e.g. the
+// continuations attached with future::then(token, func) or the tasks of
+// async(exec, token, func). Aborting is idempotent and never blocks on the
+// aborted work.
+class abort_source
+{
+private:
+	abort_state* state_;
+
+public:
+	abort_source()
+		: state_(new abort_state())
+	{}
+
+	abort_source(abort_source&& x) noexcept
+		: state_(std::exchange(x.state_, nullptr))
+	{}
+
+	abort_source(const abort_source&) = delete;
+
+	~abort_source()
+	{
+		if (state_)
+			state_->release();
+	}
+
+	abort_source& operator=(const abort_source&) = delete;
+	abort_source& operator=(abort_source&& x) noexcept
+	{
+		std::swap(state_, x.state_);
+		return *this;
+	}
+
+	abort_token get_token() const noexcept
+	{
+		return abort_token(state_);
+	}
+
+	bool requested() const noexcept
+	{
+		return state_ && state_->requested();
+	}
+
+	void request_abort() noexcept
+	{
+		if (state_)
+			state_->request_abort();
+	}
+};
+
+} // namespace dot
@@ -0,0 +1,157 @@
+#include "gtest/gtest.h"
+#include "future.hpp"
+#include "queue_executor.hpp"
+#include <thread>
+#include <mutex>
+
+using namespace dot;
+
+struct counting_subscription : public abort_subscription
+{
+	int calls{0};
+
+	virtual void on_abort() noexcept override
+	{
+		calls++;
+	}
+};
+
+TEST(AbortSourceTest, subscribe)
+{
+	abort_source as;
+	auto token = as.get_token();
+	counting_subscription a, b;
+	EXPECT_TRUE(token.subscribe(&a));
+	EXPECT_TRUE(token.subscribe(&b));
+	EXPECT_TRUE(token.unsubscribe(&b));
+	EXPECT_FALSE(token.requested());
+
+	as.request_abort();
+	as.request_abort();
+	EXPECT_TRUE(token.requested());
+	EXPECT_EQ(a.calls, 1);
+	EXPECT_EQ(b.calls, 0);
+	EXPECT_FALSE(token.unsubscribe(&a));
+	EXPECT_FALSE(token.subscribe(&b));
+
+	abort_token never;
+	EXPECT_TRUE(never.subscribe(&b));
+	EXPECT_FALSE(never.requested());
+}
+
+TEST(AbortTest, then_pending)
+{
+	abort_source as;
+	promise<int> pr;
+	auto captured = std::make_shared<int>(13);
+	bool ran = false;
+	auto res = pr.get_future().then(as.get_token(),
+		[captured, &ran](future<int> f) {
+			ran = true;
+			return f.get() + *captured;
+		}
+	);
+	EXPECT_EQ(captured.use_count(), 2);
+	EXPECT_FALSE(res.ready());
+
+	as.request_abort();
+	EXPECT_TRUE(res.ready());
+	EXPECT_EQ(captured.use_count(), 1);
+	EXPECT_THROW(res.get(), abort_requested);
+
+	pr.set_value(1);
+	EXPECT_FALSE(ran);
+}
+
+TEST(AbortTest, then_completes)
+{
+	abort_source as;
+	promise<int> pr;
+	auto res = pr.get_future().then(as.get_token(),
+		[](future<int> f) {
+			return f.get() + 1;
+		}
+	);
+	pr.set_value(1);
+	as.request_abort();
+	EXPECT_EQ(res.get(), 2);
+}
+
+TEST(AbortTest, then_aborted_already)
+{
+	abort_source as;
+	as.request_abort();
+	bool ran = false;
+	auto res = make_ready_future(1).then(as.get_token(),
+		[&ran](future<int> f) {
+			ran = true;
+		}
+	);
+	EXPECT_TRUE(res.failed());
+	EXPECT_FALSE(ran);
+
+	// ready futures without an abort run right away
+	abort_source other;
+	make_ready_future(1).then(other.get_token(),
+		[&ran](future<int> f) {
+			ran = true;
+		}
+	);
+	EXPECT_TRUE(ran);
+}
+
+TEST(AbortTest, async)
+{
+	queue_executor exec;
+	abort_source as;
+	bool ran = false;
+	auto res = dot::async(exec, as.get_token(),
+		[&ran] {
+			ran = true;
+			return 13;
+		}
+	);
+	auto done = dot::async(exec, as.get_token(), [] { return 42; });
+	exec.run_all();
+	EXPECT_EQ(done.get(), 42);
+
+	ran = false;
+	res = dot::async(exec, as.get_token(),
+		[&ran] {
+			ran = true;
+			return 13;
+		}
+	);
+	as.request_abort();
+	EXPECT_THROW(res.get(), abort_requested);
+	EXPECT_EQ(exec.run_all(), 1);
+	EXPECT_FALSE(ran);
+}
+
+TEST(AbortTest, race)
+{
+	for (int i = 0; i < 2000; ++i)
+	{
+		abort_source as;
+		promise<int> pr;
+		auto res = pr.get_future().then(as.get_token(),
+			[](future<int> f) {
+				return f.get();
+			}
+		);
+		std::thread setter(
+			[&pr, i] {
+				pr.set_value(i);
+			}
+		);
+		as.request_abort();
+		setter.join();
+		try
+		{
+			EXPECT_EQ(res.get(), i);
+		}
+		catch (const abort_requested&)
+		{
+		}
+	}
+}
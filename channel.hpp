@@ -0,0 +1,232 @@
+#include "future.hpp"
+#include "circular_buffer.hpp"
+#include <exception>
+#include <mutex>
+#include <vector>
+
+#pragma once
+
+namespace dot
+{
+
+// The exception pushes to a closed channel fail with, and so do pops once
+// a closed channel is drained.
+struct channel_closed : public std::exception
+{
+	virtual const char* what() const noexcept override
+	{
+		return "channel closed";
+	}
+};
+
+// The exception a push fails with right away when the channel is full and
+// as many pushes as it holds back are already waiting.
+struct channel_full : public std::exception
+{
+	virtual const char* what() const noexcept override
+	{
+		return "channel full";
+	}
+};
+
+
+// A bounded queue between stages, safe to use from any thread. push()
+// resolves once the value is in the buffer, right away while there is
+// room; a full channel holds the value back and resolves the push when a
+// pop makes room, so a fast producer that waits for its pushes cannot run
+// ahead by more than `capacity` values. One that does not wait is bounded
+// too: at most `max_held` pushes are held back, as many as the capacity
+// unless given, and pushes past those fail at once with channel_full, so a
+// channel never holds more than `capacity + max_held` values. pop()
+// resolves with the oldest value once there is one, pop_n() with up to `n`
+// of them, so that a consumer pays for the lock once per batch.
+//
+// Values go straight from push() to a waiting pop(). Promises are resolved
+// through a promise_batch committed after the lock is released, so
+// continuations never run under it.
+template <typename T>
+class channel
+{
+private:
+	struct pending_push
+	{
+		T value;
+		promise<> pr;
+	};
+
+	// n == 0 for pop(), the limit of a pop_n() otherwise.
+	struct pending_pop
+	{
+		promise<T> one;
+		promise<std::vector<T> > many;
+		size_t n;
+	};
+
+	spinlock lock_;
+	size_t capacity_;
+	size_t max_held_;
+	bool closed_{false};
+	circular_buffer<T> buffer_;
+	circular_buffer<pending_push> pushes_;
+	circular_buffer<pending_pop> pops_;
+
+public:
+	explicit channel(size_t capacity)
+		: channel(capacity, capacity)
+	{}
+
+	channel(size_t capacity, size_t max_held)
+		: capacity_(std::max<size_t>(capacity, 1)),
+		  max_held_(max_held)
+	{}
+
+	channel(const channel&) = delete;
+	channel& operator=(const channel&) = delete;
+
+	size_t capacity() const noexcept
+	{
+		return capacity_;
+	}
+
+	// Buffered values, not counting pushes held back.
+	size_t size()
+	{
+		std::lock_guard<spinlock> lock(lock_);
+		return buffer_.size();
+	}
+
+	bool closed()
+	{
+		std::lock_guard<spinlock> lock(lock_);
+		return closed_;
+	}
+
+	future<> push(T value)
+	{
+		promise_batch batch;
+		std::lock_guard<spinlock> lock(lock_);
+		if (closed_)
+			return make_exception_future<>(channel_closed());
+		while (!pops_.empty() && abandoned(pops_.front()))
+		{
+			pops_.pop_front();
+		}
+		if (!pops_.empty())
+		{
+			deliver(batch, pops_.front(), std::move(value));
+			pops_.pop_front();
+			return make_ready_future<>();
+		}
+		if (buffer_.size() < capacity_)
+		{
+			buffer_.push_back(std::move(value));
+			return make_ready_future<>();
+		}
+		if (pushes_.size() >= max_held_)
+			return make_exception_future<>(channel_full());
+		pushes_.push_back(pending_push{std::move(value), promise<>()});
+		return pushes_.back().pr.get_future();
+	}
+
+	future<T> pop()
+	{
+		promise_batch batch;
+		std::lock_guard<spinlock> lock(lock_);
+		if (buffer_.empty())
+		{
+			if (closed_)
+				return make_exception_future<T>(channel_closed());
+			pops_.push_back(pending_pop{promise<T>(), promise<std::vector<T> >(), 0});
+			return pops_.back().one.get_future();
+		}
+		auto fut = make_ready_future<T>(std::move(buffer_.front()));
+		buffer_.pop_front();
+		admit(batch);
+		return fut;
+	}
+
+	// Up to `n` values, at least one: what is buffered, or else the next
+	// value pushed.
+	future<std::vector<T> > pop_n(size_t n)
+	{
+		promise_batch batch;
+		std::lock_guard<spinlock> lock(lock_);
+		n = std::max<size_t>(n, 1);
+		if (buffer_.empty())
+		{
+			if (closed_)
+				return make_exception_future<std::vector<T> >(channel_closed());
+			pops_.push_back(pending_pop{promise<T>(), promise<std::vector<T> >(), n});
+			return pops_.back().many.get_future();
+		}
+		std::vector<T> values;
+		values.reserve(std::min(n, buffer_.size()));
+		while (values.size() < n && !buffer_.empty())
+		{
+			values.push_back(std::move(buffer_.front()));
+			buffer_.pop_front();
+		}
+		admit(batch);
+		return make_ready_future<std::vector<T> >(std::move(values));
+	}
+
+	// Fails the waiting pops and the pushes held back with channel_closed;
+	// buffered values can still be popped.
+	void close()
+	{
+		promise_batch batch;
+		std::lock_guard<spinlock> lock(lock_);
+		if (closed_)
+			return;
+		closed_ = true;
+		auto ex = std::make_exception_ptr(channel_closed());
+		while (!pops_.empty())
+		{
+			auto& p = pops_.front();
+			if (p.n == 0)
+				batch.set_exception(p.one, ex);
+			else
+				batch.set_exception(p.many, ex);
+			pops_.pop_front();
+		}
+		while (!pushes_.empty())
+		{
+			batch.set_exception(pushes_.front().pr, ex);
+			pushes_.pop_front();
+		}
+	}
+
+private:
+	// A pop whose future was dropped since; the value goes to the next one.
+	static bool abandoned(const pending_pop& p) noexcept
+	{
+		return p.n == 0 ? p.one.abandoned() : p.many.abandoned();
+	}
+
+	static void deliver(promise_batch& batch, pending_pop& p, T&& value)
+	{
+		if (p.n == 0)
+		{
+			batch.set_value(p.one, std::move(value));
+		}
+		else
+		{
+			std::vector<T> values;
+			values.push_back(std::move(value));
+			batch.set_value(p.many, std::move(values));
+		}
+	}
+
+	// Moves the pushes held back into the room made by a pop.
+	void admit(promise_batch& batch)
+	{
+		while (!pushes_.empty() && buffer_.size() < capacity_)
+		{
+			buffer_.push_back(std::move(pushes_.front().value));
+			batch.set_value(pushes_.front().pr);
+			pushes_.pop_front();
+		}
+	}
+};
+
+} // namespace dot
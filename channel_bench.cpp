@@ -0,0 +1,60 @@
+#include "channel.hpp"
+#include <benchmark/benchmark.h>
+#include <thread>
+
+
+// One producer thread pushing as fast as the channel lets it, the
+// benchmark thread popping one value at a time, or Arg at a time.
+static void producer_consumer(benchmark::State& state)
+{
+	constexpr int per_round = 10000;
+	for (auto _ : state)
+	{
+		dot::channel<int> ch(1024);
+		std::thread producer(
+			[&ch] {
+				for (int i = 0; i < per_round; ++i)
+				{
+					ch.push(i).get();
+				}
+				ch.close();
+			}
+		);
+		long sum = 0;
+		try
+		{
+			while (true)
+			{
+				if (state.range(0) == 1)
+				{
+					sum += ch.pop().get();
+					continue;
+				}
+				for (auto v : ch.pop_n(state.range(0)).get())
+				{
+					sum += v;
+				}
+			}
+		}
+		catch (const dot::channel_closed&)
+		{
+		}
+		producer.join();
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * per_round);
+}
+BENCHMARK(producer_consumer)->Arg(1)->Arg(64)->UseRealTime();
+
+// Push and pop on one thread, through the buffer.
+static void push_pop(benchmark::State& state)
+{
+	dot::channel<int> ch(1024);
+	for (auto _ : state)
+	{
+		ch.push(1);
+		benchmark::DoNotOptimize(ch.pop().get());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(push_pop);
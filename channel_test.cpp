@@ -0,0 +1,142 @@
+#include "gtest/gtest.h"
+#include "channel.hpp"
+#include <thread>
+
+using namespace dot;
+
+TEST(ChannelTest, push_pop)
+{
+	channel<int> ch(2);
+	EXPECT_TRUE(ch.push(1).ready());
+	EXPECT_TRUE(ch.push(2).ready());
+	EXPECT_EQ(ch.size(), 2);
+
+	// full: held back until a pop makes room
+	auto held = ch.push(3);
+	EXPECT_FALSE(held.ready());
+	EXPECT_EQ(ch.pop().get(), 1);
+	EXPECT_TRUE(held.ready());
+	EXPECT_EQ(ch.size(), 2);
+	EXPECT_EQ(ch.pop().get(), 2);
+	EXPECT_EQ(ch.pop().get(), 3);
+
+	// empty: the next push goes straight to the waiting pop
+	auto waiting = ch.pop();
+	EXPECT_FALSE(waiting.ready());
+	EXPECT_TRUE(ch.push(4).ready());
+	EXPECT_EQ(waiting.get(), 4);
+	EXPECT_EQ(ch.size(), 0);
+}
+
+TEST(ChannelTest, pop_n)
+{
+	channel<std::unique_ptr<int> > ch(8);
+	for (int i = 0; i < 5; ++i)
+	{
+		ch.push(std::make_unique<int>(i));
+	}
+	auto first = ch.pop_n(3).get();
+	ASSERT_EQ(first.size(), 3);
+	EXPECT_EQ(*first[2], 2);
+	EXPECT_EQ(ch.pop_n(10).get().size(), 2);
+
+	auto waiting = ch.pop_n(10);
+	ch.push(std::make_unique<int>(5));
+	auto next = waiting.get();
+	ASSERT_EQ(next.size(), 1);
+	EXPECT_EQ(*next[0], 5);
+}
+
+TEST(ChannelTest, close)
+{
+	channel<int> ch(1);
+	ch.push(1);
+	auto held = ch.push(2);
+	ch.close();
+	EXPECT_THROW(held.get(), channel_closed);
+	EXPECT_THROW(ch.push(3).get(), channel_closed);
+
+	// drained, then end of stream
+	EXPECT_EQ(ch.pop().get(), 1);
+	EXPECT_THROW(ch.pop().get(), channel_closed);
+
+	channel<int> empty(1);
+	auto waiting = empty.pop_n(4);
+	empty.close();
+	EXPECT_THROW(waiting.get(), channel_closed);
+}
+
+TEST(ChannelTest, max_held)
+{
+	// a producer that never waits cannot pile up pushes
+	channel<int> ch(2, 1);
+	EXPECT_TRUE(ch.push(1).ready());
+	EXPECT_TRUE(ch.push(2).ready());
+	auto held = ch.push(3);
+	EXPECT_FALSE(held.ready());
+	EXPECT_THROW(ch.push(4).get(), channel_full);
+
+	// room again once the held push is in
+	EXPECT_EQ(ch.pop().get(), 1);
+	EXPECT_TRUE(held.ready());
+	auto next = ch.push(5);
+	EXPECT_FALSE(next.ready());
+	EXPECT_EQ(ch.pop().get(), 2);
+	EXPECT_EQ(ch.pop().get(), 3);
+	EXPECT_EQ(ch.pop().get(), 5);
+
+	// by default, as many held as buffered
+	channel<int> fire_and_forget(4);
+	size_t failed = 0;
+	for (int i = 0; i < 100; ++i)
+	{
+		failed += fire_and_forget.push(i).failed();
+	}
+	EXPECT_EQ(failed, 92);
+	EXPECT_EQ(fire_and_forget.size(), 4);
+}
+
+TEST(ChannelTest, abandoned_pop)
+{
+	channel<int> ch(1);
+	ch.pop();
+	auto waiting = ch.pop();
+	ch.push(1);
+	EXPECT_EQ(waiting.get(), 1);
+}
+
+TEST(ChannelTest, threads)
+{
+	channel<int> ch(16);
+	constexpr int n = 100000;
+	std::thread producer(
+		[&ch] {
+			for (int i = 0; i < n; ++i)
+			{
+				ch.push(i).get();
+			}
+			ch.close();
+		}
+	);
+
+	long sum = 0;
+	int expected = 0;
+	try
+	{
+		while (true)
+		{
+			for (auto v : ch.pop_n(64).get())
+			{
+				EXPECT_EQ(v, expected++);
+				sum += v;
+			}
+			EXPECT_LE(ch.size(), ch.capacity());
+		}
+	}
+	catch (const channel_closed&)
+	{
+	}
+	producer.join();
+	EXPECT_EQ(expected, n);
+	EXPECT_EQ(sum, long(n) * (n - 1) / 2);
+}
@@ -1,18 +1,59 @@
 #include <memory>
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #pragma once
 
 namespace dot
 {
 
+// Whether a T can be moved to new storage by copying its bytes, with the
+// old copy left behind unconstructed: true for trivially copyable types and
+// for the standard types below that hold no pointers into themselves.
+// Specialize it as std::true_type for types of your own that qualify.
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T>
+{};
+
+template <typename T>
+struct is_trivially_relocatable<std::unique_ptr<T, std::default_delete<T> > > : std::true_type
+{};
+
+template <typename T>
+struct is_trivially_relocatable<std::shared_ptr<T> > : std::true_type
+{};
+
+template <typename T>
+struct is_trivially_relocatable<std::weak_ptr<T> > : std::true_type
+{};
+
+// Not in debug mode, where a vector keeps a list of its iterators that
+// point back at it.
+#if !defined(_GLIBCXX_DEBUG)
+template <typename T>
+struct is_trivially_relocatable<std::vector<T, std::allocator<T> > > : std::true_type
+{};
+#endif
+
+template <>
+struct is_trivially_relocatable<std::exception_ptr> : std::true_type
+{};
+
+
 template <typename T, typename Alloc>
 inline
 std::enable_if_t<std::is_nothrow_move_constructible<T>::value, void>
 transfer_pass1(Alloc& a, T* from, T* to)
 {
-	a.construct(to, std::move(*from));
-	a.destroy(from);
+	std::allocator_traits<Alloc>::construct(a, to, std::move(*from));
+	std::allocator_traits<Alloc>::destroy(a, from);
 }
 
 template <typename T, typename Alloc>
@@ -20,7 +61,7 @@ inline
 std::enable_if_t<!std::is_nothrow_move_constructible<T>::value, void>
 transfer_pass1(Alloc& a, T* from, T* to)
 {
-	a.construct(to, *from);
+	std::allocator_traits<Alloc>::construct(a, to, *from);
 }
 
 template <typename T, typename Alloc>
@@ -35,7 +76,7 @@ inline
 std::enable_if_t<!std::is_nothrow_move_constructible<T>::value, void>
 transfer_pass2(Alloc& a, T* from, T* to)
 {
-	a.destroy(from);
+	std::allocator_traits<Alloc>::destroy(a, from);
 }
 
 
@@ -43,6 +84,8 @@ template <typename T, typename Alloc = std::allocator<T> >
 class circular_buffer
 {
 private:
+	using traits = std::allocator_traits<Alloc>;
+
 	struct impl : Alloc
 	{
 		T* storage{nullptr};
@@ -59,6 +102,13 @@ public:
 	using const_reference = const T&;
 	using const_pointer = const T*;
 
+	// A contiguous run of values, or of room for them.
+	struct segment
+	{
+		T* data;
+		size_t size;
+	};
+
 public:
 	circular_buffer() = default;
 	circular_buffer(const circular_buffer&) = delete;
@@ -68,6 +118,19 @@ public:
 	circular_buffer& operator=(const circular_buffer&) = delete;
 	circular_buffer& operator=(circular_buffer&&) = delete;
 
+	~circular_buffer()
+	{
+		if (!std::is_trivially_destructible<T>::value)
+		{
+			for_each([this](T& obj) {
+					traits::destroy(impl_, &obj);
+				}
+			);
+		}
+		if (impl_.storage)
+			impl_.deallocate(impl_.storage, impl_.capacity);
+	}
+
 	bool empty() const
 	{
 		return impl_.begin == impl_.end;
@@ -83,11 +146,31 @@ public:
 		return impl_.capacity;
 	}
 
+	// Grows the capacity to fit at least `n` values, ahead of a burst.
+	void reserve(size_t n)
+	{
+		if (n > impl_.capacity)
+			expand(n);
+	}
+
+	// Shrinks the capacity to the smallest power of two that fits the
+	// values, releasing the storage when there are none.
+	void shrink_to_fit()
+	{
+		size_t new_capacity = empty() ? 0 : 1;
+		while (new_capacity < size())
+		{
+			new_capacity *= 2;
+		}
+		if (new_capacity < impl_.capacity)
+			relocate(new_capacity);
+	}
+
 	void push_front(const T& data)
 	{
 		maybe_expand();
 		auto p = &impl_.storage[mask(impl_.begin - 1)];
-		impl_.construct(p, data);
+		traits::construct(impl_, p, data);
 		--impl_.begin;
 	}
 
@@ -95,7 +178,7 @@ public:
 	{
 		maybe_expand();
 		auto p = &impl_.storage[mask(impl_.begin - 1)];
-		impl_.construct(p, std::move(data));
+		traits::construct(impl_, p, std::move(data));
 		--impl_.begin;
 	}
 
@@ -104,7 +187,7 @@ public:
 	{
 		maybe_expand();
 		auto p = &impl_.storage[mask(impl_.begin - 1)];
-		impl_.construct(p, std::forward<Args>(args)...);
+		traits::construct(impl_, p, std::forward<Args>(args)...);
 		--impl_.begin;
 	}
 
@@ -112,7 +195,7 @@ public:
 	{
 		maybe_expand();
 		auto p = &impl_.storage[mask(impl_.end)];
-		impl_.construct(p, data);
+		traits::construct(impl_, p, data);
 		++impl_.end;
 	}
 
@@ -120,7 +203,7 @@ public:
 	{
 		maybe_expand();
 		auto p = &impl_.storage[mask(impl_.end)];
-		impl_.construct(p, std::move(data));
+		traits::construct(impl_, p, std::move(data));
 		++impl_.end;
 	}
 
@@ -129,10 +212,68 @@ public:
 	{
 		maybe_expand();
 		auto p = &impl_.storage[mask(impl_.end)];
-		impl_.construct(p, std::forward<Args>(args)...);
+		traits::construct(impl_, p, std::forward<Args>(args)...);
 		++impl_.end;
 	}
 
+	// Appends [first, last), growing the buffer once up front when the
+	// length of the range is known.
+	template <typename InputIt>
+	void push_back(InputIt first, InputIt last)
+	{
+		append(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+	}
+
+	// Appends copies of data[0, n). A trivially copyable T goes in with at
+	// most two memcpys, one per side of the wrap.
+	void append_from(const T* data, size_t n)
+	{
+		if (n == 0)
+			return;
+		maybe_expand(n);
+		construct_back(data, n, std::is_trivially_copyable<T>());
+	}
+
+	// Moves up to `n` values from the front into out[0, n), raw storage the
+	// values are constructed in; returns how many there were. Should a move
+	// throw, the values moved so far are destroyed and the buffer is left as
+	// it was. Same fast path as append_from().
+	size_t consume_into(T* out, size_t n)
+	{
+		n = std::min(n, size());
+		if (n == 0)
+			return 0;
+		move_front(out, n, std::is_trivially_copyable<T>());
+		pop_front(n);
+		return n;
+	}
+
+	// The live values as at most two contiguous runs, in order; the second
+	// one is empty unless they wrap around the end of the storage. Suits
+	// writev() straight out of the buffer.
+	std::array<segment, 2> data_segments()
+	{
+		return runs(impl_.begin, size());
+	}
+
+	// All the room past the last value, at least `n`, growing the buffer if
+	// need be, as at most two contiguous runs; readv() can fill it in place.
+	// What was written becomes live with commit().
+	std::array<segment, 2> writable_segments(size_t n)
+	{
+		static_assert(std::is_trivially_copyable<T>::value,
+					  "values are written into raw storage");
+		maybe_expand(n);
+		return runs(impl_.end, impl_.capacity - size());
+	}
+
+	// Appends the first `n` values written to writable_segments().
+	void commit(size_t n)
+	{
+		assert(n <= impl_.capacity - size());
+		impl_.end += n;
+	}
+
 	T& front()
 	{
 		return impl_.storage[mask(impl_.begin)];
@@ -145,13 +286,26 @@ public:
 
 	void pop_front()
 	{
-		impl_.destroy(&front());
+		traits::destroy(impl_, &front());
 		++impl_.begin;
 	}
 
+	void pop_front(size_t n)
+	{
+		assert(n <= size());
+		if (!std::is_trivially_destructible<T>::value)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				traits::destroy(impl_, &impl_.storage[mask(impl_.begin + i)]);
+			}
+		}
+		impl_.begin += n;
+	}
+
 	void pop_back()
 	{
-		impl_.destroy(&back());
+		traits::destroy(impl_, &back());
 		--impl_.end;
 	}
 
@@ -183,11 +337,146 @@ public:
 	}
 
 private:
-	void expand()
+	template <typename InputIt>
+	void append(InputIt first, InputIt last, std::input_iterator_tag)
+	{
+		for (; first != last; ++first)
+		{
+			emplace_back(*first);
+		}
+	}
+
+	template <typename ForwardIt>
+	void append(ForwardIt first, ForwardIt last, std::forward_iterator_tag)
+	{
+		auto n = size_t(std::distance(first, last));
+		if (n == 0)
+			return;
+		maybe_expand(n);
+		constexpr bool raw = std::is_trivially_copyable<T>::value &&
+			(std::is_same<ForwardIt, T*>::value || std::is_same<ForwardIt, const T*>::value);
+		construct_back(first, n, std::integral_constant<bool, raw>());
+	}
+
+	// How many of `n` values from index `idx` on lie before the wrap.
+	size_t contiguous(size_t idx, size_t n) const
+	{
+		return std::min(n, impl_.capacity - mask(idx));
+	}
+
+	std::array<segment, 2> runs(size_t idx, size_t n)
+	{
+		if (n == 0)
+			return {{{impl_.storage, 0}, {impl_.storage, 0}}};
+		auto k = contiguous(idx, n);
+		return {{{&impl_.storage[mask(idx)], k}, {impl_.storage, n - k}}};
+	}
+
+	void construct_back(const T* from, size_t n, std::true_type)
+	{
+		auto k = contiguous(impl_.end, n);
+		std::memcpy(&impl_.storage[mask(impl_.end)], from, k * sizeof(T));
+		std::memcpy(impl_.storage, from + k, (n - k) * sizeof(T));
+		impl_.end += n;
+	}
+
+	template <typename InputIt>
+	void construct_back(InputIt from, size_t n, std::false_type)
+	{
+		size_t i = 0;
+		try
+		{
+			for (; i < n; ++i, ++from)
+			{
+				traits::construct(impl_, &impl_.storage[mask(impl_.end + i)], *from);
+			}
+		}
+		catch (...)
+		{
+			while (i)
+			{
+				traits::destroy(impl_, &impl_.storage[mask(impl_.end + --i)]);
+			}
+			throw;
+		}
+		impl_.end += n;
+	}
+
+	void move_front(T* to, size_t n, std::true_type)
+	{
+		auto k = contiguous(impl_.begin, n);
+		std::memcpy(to, &impl_.storage[mask(impl_.begin)], k * sizeof(T));
+		std::memcpy(to + k, impl_.storage, (n - k) * sizeof(T));
+	}
+
+	void move_front(T* to, size_t n, std::false_type)
+	{
+		size_t i = 0;
+		try
+		{
+			for (; i < n; ++i)
+			{
+				::new (static_cast<void*>(to + i)) T(std::move(impl_.storage[mask(impl_.begin + i)]));
+			}
+		}
+		catch (...)
+		{
+			while (i)
+			{
+				to[--i].~T();
+			}
+			throw;
+		}
+	}
+
+	// Doubles the capacity until `min_capacity` fits.
+	void expand(size_t min_capacity = 1)
 	{
 		auto new_capacity = std::max<size_t>(impl_.capacity * 2, 1);
-		auto new_storage = impl_.allocate(new_capacity);
-		auto p = new_storage;
+		while (new_capacity < min_capacity)
+		{
+			new_capacity *= 2;
+		}
+		relocate(new_capacity);
+	}
+
+	// Moves the values to the start of new storage for `new_capacity`, which
+	// must hold them all.
+	void relocate(size_t new_capacity)
+	{
+		auto new_storage = new_capacity ? impl_.allocate(new_capacity) : nullptr;
+		try
+		{
+			transfer(new_storage, is_trivially_relocatable<T>());
+		}
+		catch (...)
+		{
+			impl_.deallocate(new_storage, new_capacity);
+			throw;
+		}
+		auto n = size();
+		std::swap(impl_.storage, new_storage);
+		std::swap(impl_.capacity, new_capacity);
+		impl_.begin = 0;
+		impl_.end = n;
+		if (new_storage)
+			impl_.deallocate(new_storage, new_capacity);
+	}
+
+	// The bytes move and the old copies are simply forgotten: one memcpy per
+	// run, which also unwraps the ring.
+	void transfer(T* to, std::true_type)
+	{
+		if (empty())
+			return;
+		auto d = runs(impl_.begin, size());
+		std::memcpy(static_cast<void*>(to), d[0].data, d[0].size * sizeof(T));
+		std::memcpy(static_cast<void*>(to + d[0].size), d[1].data, d[1].size * sizeof(T));
+	}
+
+	void transfer(T* to, std::false_type)
+	{
+		auto p = to;
 		try
 		{
 			for_each([this, &p](T& obj) {
@@ -198,32 +487,25 @@ private:
 		}
 		catch (...)
 		{
-			while (p != new_storage)
+			while (p != to)
 			{
-				impl_.destroy(--p);
+				traits::destroy(impl_, --p);
 			}
-			impl_.deallocate(new_storage, new_capacity);
 			throw;
 		}
 
-		p = new_storage;
+		p = to;
 		for_each([this, &p](T& obj) {
 				transfer_pass2(impl_, &obj, p++);
 			}
 		);
-
-		std::swap(impl_.storage, new_storage);
-		std::swap(impl_.capacity, new_capacity);
-		impl_.begin = 0;
-		impl_.end = p - impl_.storage;
-		impl_.deallocate(new_storage, new_capacity);
 	}
 
 	void maybe_expand(size_t nr = 1)
 	{
 		if (impl_.end - impl_.begin + nr > impl_.capacity)
 		{
-			expand();
+			expand(impl_.end - impl_.begin + nr);
 		}
 	}
 
@@ -234,10 +516,13 @@ private:
 
 private:
 	template <typename CB, typename ValueType>
-	struct cbiterator : std::iterator<std::random_access_iterator_tag, ValueType>
+	struct cbiterator
 	{
-		using super_t = std::iterator<std::random_access_iterator_tag, ValueType>;
-		using typename std::iterator<std::random_access_iterator_tag, ValueType>::difference_type;
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = std::remove_const_t<ValueType>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = ValueType*;
+		using reference = ValueType&;
 
 		ValueType& operator*() const { return cb->impl_.storage[cb->mask(idx)]; }
 		ValueType* operator->() const { return &cb->impl_.storage[cb->mask(idx)]; }
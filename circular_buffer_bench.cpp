@@ -0,0 +1,268 @@
+#include "circular_buffer.hpp"
+#include "mirrored_ring.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+namespace
+{
+
+constexpr size_t per_round = 16 << 20;
+constexpr size_t chunk = 64 << 10;
+
+// Bytes from a writer thread through a unix socket into a ring, and from
+// the ring out to /dev/null. `relay` gets the socket, the sink and the ring
+// and moves whatever one read brings in before the next.
+template <typename Relay>
+void relay_bytes(benchmark::State& state, Relay relay)
+{
+	int sink = ::open("/dev/null", O_WRONLY);
+	for (auto _ : state)
+	{
+		int fds[2];
+		::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+		std::thread writer(
+			[fd = fds[1]] {
+				static char data[chunk];
+				for (size_t sent = 0; sent < per_round; )
+				{
+					auto n = ::write(fd, data, std::min(chunk, per_round - sent));
+					if (n <= 0)
+						break;
+					sent += n;
+				}
+				::close(fd);
+			}
+		);
+		dot::circular_buffer<char> cb;
+		size_t received = 0;
+		while (received < per_round)
+		{
+			auto n = relay(fds[0], sink, cb);
+			if (n <= 0)
+				break;
+			received += n;
+		}
+		writer.join();
+		::close(fds[0]);
+	}
+	::close(sink);
+	state.SetBytesProcessed(state.iterations() * per_round);
+}
+
+} // namespace
+
+// readv() into writable_segments(), writev() out of data_segments().
+static void relay_segments(benchmark::State& state)
+{
+	relay_bytes(state,
+		[](int src, int dst, dot::circular_buffer<char>& cb) {
+			auto w = cb.writable_segments(chunk);
+			iovec in[2] = {{w[0].data, w[0].size}, {w[1].data, w[1].size}};
+			auto n = ::readv(src, in, 2);
+			if (n <= 0)
+				return n;
+			cb.commit(n);
+			auto d = cb.data_segments();
+			iovec out[2] = {{d[0].data, d[0].size}, {d[1].data, d[1].size}};
+			auto m = ::writev(dst, out, 2);
+			if (m > 0)
+				cb.pop_front(m);
+			return n;
+		}
+	);
+}
+BENCHMARK(relay_segments)->UseRealTime();
+
+// read() into a scratch buffer, push_back() byte by byte, and back out
+// through front()/pop_front() into another scratch buffer for write().
+static void relay_push_back(benchmark::State& state)
+{
+	relay_bytes(state,
+		[](int src, int dst, dot::circular_buffer<char>& cb) {
+			static char scratch[chunk];
+			auto n = ::read(src, scratch, chunk);
+			if (n <= 0)
+				return n;
+			for (ssize_t i = 0; i < n; ++i)
+			{
+				cb.push_back(scratch[i]);
+			}
+			size_t m = 0;
+			while (!cb.empty())
+			{
+				scratch[m++] = cb.front();
+				cb.pop_front();
+			}
+			::write(dst, scratch, m);
+			return n;
+		}
+	);
+}
+BENCHMARK(relay_push_back)->UseRealTime();
+
+// The same two copies with append_from() and consume_into().
+static void relay_bulk_copy(benchmark::State& state)
+{
+	relay_bytes(state,
+		[](int src, int dst, dot::circular_buffer<char>& cb) {
+			static char scratch[chunk];
+			auto n = ::read(src, scratch, chunk);
+			if (n <= 0)
+				return n;
+			cb.append_from(scratch, n);
+			auto m = cb.consume_into(scratch, chunk);
+			::write(dst, scratch, m);
+			return n;
+		}
+	);
+}
+BENCHMARK(relay_bulk_copy)->UseRealTime();
+
+namespace
+{
+
+// Length-prefixed records of 1..200 bytes, pushed in 4 KiB writes and
+// summed up as they complete.
+constexpr size_t write_size = 4096;
+
+std::vector<char> make_records()
+{
+	std::vector<char> stream;
+	for (uint32_t i = 0; stream.size() < (1 << 20); ++i)
+	{
+		uint32_t len = 1 + i * 7 % 200;
+		auto p = reinterpret_cast<const char*>(&len);
+		stream.insert(stream.end(), p, p + sizeof(len));
+		stream.insert(stream.end(), len, char(i));
+	}
+	return stream;
+}
+
+} // namespace
+
+// Records out of circular_buffer segments: a record straddling the wrap is
+// copied out before it can be read.
+static void parse_segments(benchmark::State& state)
+{
+	auto stream = make_records();
+	dot::circular_buffer<char> cb;
+	std::vector<char> scratch;
+	for (auto _ : state)
+	{
+		long sum = 0;
+		for (size_t off = 0; off < stream.size(); off += write_size)
+		{
+			cb.append_from(stream.data() + off, std::min(write_size, stream.size() - off));
+			while (cb.size() >= sizeof(uint32_t))
+			{
+				auto d = cb.data_segments();
+				uint32_t len;
+				if (d[0].size >= sizeof(len))
+				{
+					std::memcpy(&len, d[0].data, sizeof(len));
+				}
+				else
+				{
+					std::memcpy(&len, d[0].data, d[0].size);
+					std::memcpy(reinterpret_cast<char*>(&len) + d[0].size, d[1].data, sizeof(len) - d[0].size);
+				}
+				auto total = sizeof(len) + len;
+				if (cb.size() < total)
+					break;
+				const char* record;
+				if (d[0].size >= total)
+				{
+					record = d[0].data + sizeof(len);
+				}
+				else
+				{
+					scratch.resize(total);
+					std::memcpy(scratch.data(), d[0].data, d[0].size);
+					std::memcpy(scratch.data() + d[0].size, d[1].data, total - d[0].size);
+					record = scratch.data() + sizeof(len);
+				}
+				sum += record[0] + record[len - 1];
+				cb.pop_front(total);
+			}
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(parse_segments);
+
+// The same records out of a mirrored_ring, always in place.
+static void parse_mirrored(benchmark::State& state)
+{
+	auto stream = make_records();
+	dot::mirrored_ring<char> ring;
+	for (auto _ : state)
+	{
+		long sum = 0;
+		for (size_t off = 0; off < stream.size(); off += write_size)
+		{
+			ring.append_from(stream.data() + off, std::min(write_size, stream.size() - off));
+			while (ring.size() >= sizeof(uint32_t))
+			{
+				uint32_t len;
+				std::memcpy(&len, ring.data(), sizeof(len));
+				auto total = sizeof(len) + len;
+				if (ring.size() < total)
+					break;
+				auto record = ring.data() + sizeof(len);
+				sum += record[0] + record[len - 1];
+				ring.pop_front(total);
+			}
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(parse_mirrored);
+
+namespace
+{
+
+// Same layout as a unique_ptr, but not marked relocatable.
+struct boxed_ptr
+{
+	std::unique_ptr<int> p;
+};
+
+} // namespace
+
+// A burst of `Arg` values into an empty buffer that wrapped once before,
+// so every growth has to unwrap it. With `Reserve`, capacity is set aside
+// first.
+template <typename T, bool Reserve>
+static void grow(benchmark::State& state)
+{
+	auto n = size_t(state.range(0));
+	for (auto _ : state)
+	{
+		dot::circular_buffer<T> cb;
+		cb.emplace_back();
+		cb.pop_front();
+		if (Reserve)
+			cb.reserve(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			cb.emplace_back();
+		}
+		benchmark::DoNotOptimize(cb.front());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(grow, std::unique_ptr<int>, false)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(grow, boxed_ptr, false)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(grow, std::string, false)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(grow, std::unique_ptr<int>, true)->Arg(1 << 16);
@@ -1,6 +1,8 @@
 #include "gtest/gtest.h"
 #include "circular_buffer.hpp"
+#include <cstring>
 #include <sstream>
+#include <vector>
 
 using namespace dot;
 
@@ -89,3 +91,202 @@ TEST(CircularBufferTest, empty)
 	cb.pop_back();
 	EXPECT_TRUE(cb.empty());
 }
+
+TEST(CircularBufferTest, bulk)
+{
+	circular_buffer<int> cb;
+	int in[] = {1, 2, 3, 4, 5, 6};
+	cb.append_from(in, 3);
+	EXPECT_EQ(cb.capacity(), 4);
+
+	// grows once, to fit, and wraps
+	int out[8];
+	EXPECT_EQ(cb.consume_into(out, 2), 2);
+	EXPECT_EQ(out[1], 2);
+	cb.push_back(in + 3, in + 6);
+	EXPECT_EQ(values(cb), "3456");
+	cb.push_back(std::begin(in), std::end(in));
+	EXPECT_EQ(cb.capacity(), 16);
+	EXPECT_EQ(values(cb), "3456123456");
+
+	cb.pop_front(4);
+	EXPECT_EQ(cb.consume_into(out, 8), 6);
+	EXPECT_EQ(out[0], 1);
+	EXPECT_EQ(out[5], 6);
+	EXPECT_TRUE(cb.empty());
+	EXPECT_EQ(cb.consume_into(out, 8), 0);
+}
+
+TEST(CircularBufferTest, bulk_object)
+{
+	circular_buffer<node> cb;
+	cb.emplace_back(0, "zero");
+	cb.emplace_back(1, "one");
+	cb.pop_front();
+	std::vector<node> in = {{2, "two"}, {3, "three"}, {4, "four"}};
+	cb.push_back(in.begin(), in.end());
+	EXPECT_EQ(values(cb), "1one2two3three4four");
+
+	// moved into raw storage
+	std::aligned_storage<sizeof(node), alignof(node)>::type raw[3];
+	auto out = reinterpret_cast<node*>(raw);
+	EXPECT_EQ(cb.consume_into(out, 3), 3);
+	EXPECT_EQ(out[2].value, "three");
+	EXPECT_EQ(values(cb), "4four");
+	for (int i = 0; i < 3; ++i)
+	{
+		out[i].~node();
+	}
+
+	std::istringstream is("5 6");
+	circular_buffer<int> ints;
+	ints.push_back(std::istream_iterator<int>(is), std::istream_iterator<int>());
+	EXPECT_EQ(values(ints), "56");
+}
+
+TEST(CircularBufferTest, segments)
+{
+	circular_buffer<char> cb;
+	auto w = cb.writable_segments(6);
+	EXPECT_EQ(cb.capacity(), 8);
+	EXPECT_EQ(w[0].size, 8);
+	EXPECT_EQ(w[1].size, 0);
+	std::memcpy(w[0].data, "abcdef", 6);
+	cb.commit(6);
+	cb.pop_front(4);
+
+	// the room wraps: two to the end of the storage, four from its start
+	w = cb.writable_segments(6);
+	EXPECT_EQ(cb.capacity(), 8);
+	ASSERT_EQ(w[0].size, 2);
+	ASSERT_EQ(w[1].size, 4);
+	std::memcpy(w[0].data, "gh", 2);
+	std::memcpy(w[1].data, "ijk", 3);
+	cb.commit(5);
+
+	auto d = cb.data_segments();
+	EXPECT_EQ(std::string(d[0].data, d[0].size), "efgh");
+	EXPECT_EQ(std::string(d[1].data, d[1].size), "ijk");
+
+	cb.pop_front(7);
+	d = cb.data_segments();
+	EXPECT_EQ(d[0].size + d[1].size, 0);
+}
+
+struct tracked
+{
+	static int live;
+	int id;
+	tracked(int x) : id(x) { ++live; }
+	tracked(const tracked& x) : id(x.id) { ++live; }
+	~tracked() { --live; }
+};
+
+int tracked::live = 0;
+
+TEST(CircularBufferTest, relocate)
+{
+	static_assert(is_trivially_relocatable<std::unique_ptr<int> >::value, "");
+	static_assert(!is_trivially_relocatable<tracked>::value, "");
+
+	// grows with a memcpy, unwrapping the ring
+	circular_buffer<std::unique_ptr<int> > cb;
+	for (int i = 0; i < 4; ++i)
+	{
+		cb.push_back(std::make_unique<int>(i));
+	}
+	cb.pop_front();
+	cb.push_back(std::make_unique<int>(4));
+	cb.push_back(std::make_unique<int>(5));
+	EXPECT_EQ(cb.capacity(), 8);
+	for (int i = 0; i < 5; ++i)
+	{
+		EXPECT_EQ(*cb[i], i + 1);
+	}
+
+	cb.reserve(20);
+	EXPECT_EQ(cb.capacity(), 32);
+	EXPECT_EQ(*cb.front(), 1);
+	cb.pop_front(3);
+	cb.shrink_to_fit();
+	EXPECT_EQ(cb.capacity(), 2);
+	EXPECT_EQ(*cb.front(), 4);
+	EXPECT_EQ(*cb.back(), 5);
+	cb.pop_front(2);
+	cb.shrink_to_fit();
+	EXPECT_EQ(cb.capacity(), 0);
+}
+
+TEST(CircularBufferTest, destroy)
+{
+	{
+		circular_buffer<tracked> cb;
+		for (int i = 0; i < 5; ++i)
+		{
+			cb.emplace_front(i);
+		}
+		cb.reserve(100);
+		cb.shrink_to_fit();
+		EXPECT_EQ(cb.capacity(), 8);
+		EXPECT_EQ(tracked::live, 5);
+		EXPECT_EQ(cb.back().id, 0);
+	}
+	EXPECT_EQ(tracked::live, 0);
+}
+
+// Counts the blocks it has handed out and not taken back.
+template <typename T>
+struct counting_allocator
+{
+	using value_type = T;
+
+	static int blocks;
+
+	counting_allocator() = default;
+	template <typename U>
+	counting_allocator(const counting_allocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		++blocks;
+		return std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		--blocks;
+		std::allocator<T>().deallocate(p, n);
+	}
+};
+
+template <typename T>
+int counting_allocator<T>::blocks = 0;
+
+TEST(CircularBufferTest, destructor)
+{
+	using allocator = counting_allocator<tracked>;
+	{
+		circular_buffer<tracked, allocator> cb;
+		for (int i = 0; i < 6; ++i)
+		{
+			cb.emplace_back(i);
+		}
+		cb.pop_front(3);
+		for (int i = 6; i < 9; ++i)
+		{
+			cb.emplace_back(i);
+		}
+		// wrapped, with popped slots in between
+		EXPECT_EQ(cb.capacity(), 8);
+		EXPECT_EQ(tracked::live, 6);
+		EXPECT_EQ(allocator::blocks, 1);
+	}
+	// the live values only, and the storage
+	EXPECT_EQ(tracked::live, 0);
+	EXPECT_EQ(allocator::blocks, 0);
+
+	{
+		circular_buffer<int, counting_allocator<int> > empty;
+	}
+	EXPECT_EQ(counting_allocator<int>::blocks, 0);
+}
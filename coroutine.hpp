@@ -0,0 +1,115 @@
+#include "future.hpp"
+#include <coroutine>
+
+#pragma once
+
+// C++20 coroutine support: `co_await` on a dot::future, and dot::future as
+// the return type of a coroutine. Needs -std=c++20.
+
+namespace dot
+{
+
+// Awaiting a ready future does not suspend. Awaiting a pending one stores
+// the coroutine handle as the future's continuation, in place in its
+// shared state: no promise, no extra future, no allocation.
+template <typename... T>
+struct future_awaiter
+{
+	future<T...> fut_;
+
+	bool await_ready() const noexcept
+	{
+		return fut_.ready();
+	}
+
+	void await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		auto cont = [this, h](future<T...> f) {
+			fut_ = std::move(f);
+			h.resume();
+		};
+		if (auto exec = local_executor())
+			fut_.schedule(*exec, std::move(cont));
+		else
+			fut_.schedule(std::move(cont));
+	}
+
+	decltype(auto) await_resume()
+	{
+		return fut_.get();
+	}
+};
+
+template <typename... T>
+inline future_awaiter<T...> operator co_await(future<T...>&& fut) noexcept
+{
+	return future_awaiter<T...>{std::move(fut)};
+}
+
+inline future_awaiter<> operator co_await(future<void>&& fut) noexcept
+{
+	return future_awaiter<>{std::move(fut)};
+}
+
+
+// Promise type of coroutines returning future<T...>. The coroutine runs
+// eagerly up to its first suspension, and its frame is freed as soon as it
+// finishes.
+template <typename... T>
+struct coroutine_promise_base
+{
+	promise<T...> pr_;
+
+	future<T...> get_return_object()
+	{
+		return pr_.get_future();
+	}
+
+	std::suspend_never initial_suspend() noexcept
+	{
+		return {};
+	}
+
+	std::suspend_never final_suspend() noexcept
+	{
+		return {};
+	}
+
+	void unhandled_exception() noexcept
+	{
+		pr_.set_exception(std::current_exception());
+	}
+};
+
+template <typename... T>
+struct coroutine_promise : public coroutine_promise_base<T...>
+{
+	template <typename U>
+	void return_value(U&& value)
+	{
+		this->pr_.set_value(std::forward<U>(value));
+	}
+};
+
+template <>
+struct coroutine_promise<> : public coroutine_promise_base<>
+{
+	void return_void()
+	{
+		pr_.set_value();
+	}
+};
+
+} // namespace dot
+
+template <typename... T, typename... Args>
+struct std::coroutine_traits<dot::future<T...>, Args...>
+{
+	using promise_type = dot::coroutine_promise<T...>;
+};
+
+template <typename... Args>
+struct std::coroutine_traits<dot::future<void>, Args...>
+{
+	using promise_type = dot::coroutine_promise<>;
+};
@@ -0,0 +1,107 @@
+#include "coroutine.hpp"
+#include <benchmark/benchmark.h>
+
+
+static constexpr int hops = 10;
+
+static void then_chain_ready(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		auto fut = dot::make_ready_future<int>(0);
+		for (int i = 0; i < hops; i++)
+		{
+			fut = fut.then([](dot::future<int> f) { return f.get() + 1; });
+		}
+		benchmark::DoNotOptimize(fut.get());
+	}
+}
+BENCHMARK(then_chain_ready);
+
+static dot::future<int> await_ready_hops()
+{
+	int sum = 0;
+	for (int i = 0; i < hops; i++)
+	{
+		sum += co_await dot::make_ready_future<int>(1);
+	}
+	co_return sum;
+}
+
+static void coroutine_ready(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(await_ready_hops().get());
+	}
+}
+BENCHMARK(coroutine_ready);
+
+
+// Each hop waits on a future that is still pending when it is reached.
+static void then_chain_pending(benchmark::State& state)
+{
+	std::vector<dot::promise<int> > promises(hops);
+	for (auto _ : state)
+	{
+		std::vector<dot::future<int> > futures;
+		for (auto& pr : promises)
+		{
+			pr = dot::promise<int>();
+			futures.push_back(pr.get_future());
+		}
+
+		auto fut = dot::make_ready_future<int>(0);
+		for (int i = 0; i < hops; i++)
+		{
+			fut = fut.then(
+				[next = std::move(futures[i])](dot::future<int> f) mutable {
+					auto sum = f.get();
+					return next.then(
+						[sum](dot::future<int> n) {
+							return sum + n.get();
+						}
+					);
+				}
+			);
+		}
+		for (auto& pr : promises)
+		{
+			pr.set_value(1);
+		}
+		benchmark::DoNotOptimize(fut.get());
+	}
+}
+BENCHMARK(then_chain_pending);
+
+static dot::future<int> await_pending_hops(std::vector<dot::future<int> >& futures)
+{
+	int sum = 0;
+	for (auto& f : futures)
+	{
+		sum += co_await std::move(f);
+	}
+	co_return sum;
+}
+
+static void coroutine_pending(benchmark::State& state)
+{
+	std::vector<dot::promise<int> > promises(hops);
+	for (auto _ : state)
+	{
+		std::vector<dot::future<int> > futures;
+		for (auto& pr : promises)
+		{
+			pr = dot::promise<int>();
+			futures.push_back(pr.get_future());
+		}
+
+		auto fut = await_pending_hops(futures);
+		for (auto& pr : promises)
+		{
+			pr.set_value(1);
+		}
+		benchmark::DoNotOptimize(fut.get());
+	}
+}
+BENCHMARK(coroutine_pending);
@@ -0,0 +1,100 @@
+#include "gtest/gtest.h"
+#include "coroutine.hpp"
+#include "reactor.hpp"
+
+using namespace dot;
+
+static future<int> add_one(future<int> fut)
+{
+	co_return co_await std::move(fut) + 1;
+}
+
+static future<> count(future<> fut, int& counter)
+{
+	co_await std::move(fut);
+	counter++;
+}
+
+static future<int> fail(future<int> fut)
+{
+	co_await std::move(fut);
+	throw std::runtime_error("error");
+}
+
+TEST(CoroutineTest, ready)
+{
+	auto fut = add_one(make_ready_future<int>(1));
+	EXPECT_TRUE(fut.ready());
+	EXPECT_EQ(fut.get(), 2);
+}
+
+TEST(CoroutineTest, pending)
+{
+	promise<int> pr;
+	auto fut = add_one(pr.get_future());
+	EXPECT_FALSE(fut.ready());
+	pr.set_value(13);
+	EXPECT_EQ(fut.get(), 14);
+}
+
+TEST(CoroutineTest, void_future)
+{
+	int counter = 0;
+	promise<> pr;
+	future<void> fut = count(pr.get_future(), counter);
+	EXPECT_EQ(counter, 0);
+	pr.set_value();
+	fut.get();
+	EXPECT_EQ(counter, 1);
+}
+
+TEST(CoroutineTest, exception)
+{
+	promise<int> pr;
+	auto fut = fail(pr.get_future());
+	pr.set_value(1);
+	EXPECT_THROW(fut.get(), std::runtime_error);
+
+	promise<int> broken;
+	auto f2 = add_one(broken.get_future());
+	broken.set_exception(std::logic_error("broken"));
+	EXPECT_THROW(f2.get(), std::logic_error);
+}
+
+TEST(CoroutineTest, chain)
+{
+	promise<int> pr;
+	auto fut = pr.get_future();
+	for (int i = 0; i < 10; i++)
+	{
+		fut = add_one(std::move(fut));
+	}
+	std::thread setter([&pr] { pr.set_value(0); });
+	EXPECT_EQ(fut.get(), 10);
+	setter.join();
+}
+
+TEST(CoroutineTest, resumes_on_reactor)
+{
+	reactor r;
+	std::thread t([&r] { r.run(); });
+
+	promise<int> pr;
+	future<bool> res;
+	std::promise<void> started;
+	r.schedule(make_task(
+		[&] {
+			res = [](future<int> fut, reactor* r) -> future<bool> {
+				co_await std::move(fut);
+				co_return reactor::local() == r;
+			}(pr.get_future(), &r);
+			started.set_value();
+		}
+	));
+	started.get_future().wait();
+	std::thread([&pr] { pr.set_value(1); }).join();
+	EXPECT_TRUE(res.get());
+
+	r.stop();
+	t.join();
+}
@@ -1,12 +1,25 @@
+#include "abort.hpp"
+#include "slab.hpp"
+#include "circular_buffer.hpp"
 #include <future>
+#include <algorithm>
 #include <exception>
 #include <thread>
 #include <chrono>
 #include <cassert>
+#include <climits>
+#include <cstddef>
 #include <memory>
 #include <atomic>
 #include <vector>
+#include <array>
 #include <iterator>
+#include <utility>
+#include <ctime>
+#include <system_error>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #pragma once
 
@@ -21,8 +34,17 @@ template <typename... T>
 class promise;
 
 
+template <typename... T>
+class shared_future;
+
+
+template <typename... T>
+class shared_state;
+
+
 struct ready_future_marker {};
 struct exception_future_marker {};
+struct error_future_marker {};
 
 
 enum class future_status
@@ -37,6 +59,30 @@ template <typename... T>
 struct futurize;
 
 
+template <typename... T>
+struct future_awaiter;
+
+
+template <typename Results, typename Inputs>
+struct when_any_context;
+
+
+template <typename... T>
+struct timeout_link;
+
+
+// Tells the core we are busy-waiting, so it can back off the pipeline
+// and give a sibling hyperthread the resources.
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#endif
+}
+
+
 class spinlock
 {
 private:
@@ -46,583 +92,1885 @@ public:
 	spinlock() = default;
 	~spinlock() = default;
 	inline void lock()	{
-		while (lock_.test_and_set(std::memory_order_acquire))
-			std::this_thread::yield();
+		for (unsigned i = 0; lock_.test_and_set(std::memory_order_acquire); ++i)
+		{
+			if (i < 64)
+				cpu_relax();
+			else
+				std::this_thread::yield();
+		}
 	}
 	inline void unlock() { lock_.clear(std::memory_order_release);	}
 };
 
 
+// How a blocking wait on a future spends its time before parking: first
+// `spins` rounds of cpu_relax(), then `yields` rounds of yielding the CPU.
+// Spinning pays off when the producer runs on another core and answers
+// within microseconds; on a single CPU it only delays the producer, so the
+// default skips it there.
+struct wait_policy
+{
+	unsigned spins{std::thread::hardware_concurrency() > 1 ? 1000u : 0u};
+	unsigned yields{16};
+};
+
+// Which phase the blocking waits of a thread ended in.
+struct wait_stats
+{
+	uint64_t spun{0};
+	uint64_t yielded{0};
+	uint64_t parked{0};
+};
+
+inline wait_policy& local_wait_policy() noexcept
+{
+	static thread_local wait_policy policy;
+	return policy;
+}
+
+inline wait_stats& local_wait_stats() noexcept
+{
+	static thread_local wait_stats stats;
+	return stats;
+}
+
+
+// Sleeps while `word` still holds `expected`; spurious wakeups are possible.
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected,
+					   const struct timespec* timeout = nullptr) noexcept
+{
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+			expected, timeout, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>& word, int count = INT_MAX) noexcept
+{
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+			count, nullptr, nullptr, 0);
+}
+
+
+// A unit of work queued on an executor. run() is called exactly once and
+// disposes of the task itself.
 struct task
 {
 	virtual ~task() {};
 	virtual void run() noexcept = 0;
 };
 
-template <typename Func, typename T>
-struct continuation : public task
+template <typename Func>
+struct lambda_task final : public task, public pooled
 {
-	continuation(Func&& func, T&& arg)
-		: func_(std::move(func)),
-		  arg_(std::move(arg))
+	lambda_task(Func&& func)
+		: func_(std::move(func))
 	{}
 
 	virtual void run() noexcept override
 	{
-		arg_.set_ready();
-		func_(std::move(arg_));
+		std::unique_ptr<lambda_task> self(this);
+		func_();
 	}
 
 	Func func_;
-	T arg_;
 };
 
-
-template <typename... T>
-struct promise_impl { using type = std::promise<T...>; };
-template <>
-struct promise_impl<> { using type = std::promise<void>; };
-
-template <typename... T>
-class promise
+template <typename Func>
+inline task* make_task(Func&& func)
 {
-	template <typename... U>
-	friend class future;
-
-private:
-	using impl_type = typename promise_impl<T...>::type;
-	impl_type impl_;
-
-	future<T...>* future_{nullptr};
-	std::unique_ptr<task> continuation_{nullptr};
-	spinlock lock_;
-	std::atomic<bool> set_{false};
-
-public:
-	promise() noexcept {}
-
-	promise(promise&& x) noexcept
-		: impl_(std::move(x.impl_)),
-		  future_(std::exchange(x.future_, nullptr)),
-		  continuation_(std::exchange(x.continuation_, nullptr))
-	{
-		if (future_)
-			future_->promise_ = this;
-	}
+	return new lambda_task<std::decay_t<Func> >(std::forward<Func>(func));
+}
 
-	promise(const promise&) = delete;
 
-	~promise() noexcept
-	{
-		if (future_)
-			future_->promise_ = nullptr;
-	}
+// Decides where continuations run. add() takes a task that has to be run
+// once, on whatever thread the executor picks. add_batch() takes several
+// at once; executors override it to queue them with one lock and one
+// wakeup. concurrency() is how many tasks it can run at the same time,
+// used to size parallel work.
+struct executor
+{
+	virtual ~executor() {};
+	virtual void add(task* t) noexcept = 0;
+	virtual size_t concurrency() const noexcept { return 1; }
 
-	promise& operator=(promise&& x) noexcept
+	virtual void add_batch(task** tasks, size_t n) noexcept
 	{
-		if (this != &x)
+		for (size_t i = 0; i < n; ++i)
 		{
-			this->~promise();
-			new (this) promise(std::move(x));
+			add(tasks[i]);
 		}
-		return *this;
 	}
+};
 
-	future<T...> get_future()
+// Runs tasks right away on the calling thread.
+struct inline_executor final : public executor
+{
+	virtual void add(task* t) noexcept override
 	{
-		return future<T...>(this);
+		t->run();
 	}
+};
 
-	template <typename... A>
-	inline void set_value(A&&... a)
-	{
-		impl_.set_value(std::forward<A>(a)...);
-		notify();
-	}
+// Collects the tasks that continuations would add to their executors while
+// a promise_batch commits, so that each executor gets them in one
+// add_batch().
+class task_batch
+{
+private:
+	std::vector<std::pair<executor*, std::vector<task*> > > groups_;
 
-	inline void set_exception(std::exception_ptr ex)
+public:
+	void add(executor& exec, task* t)
 	{
-		impl_.set_exception(ex);
-		notify();
+		for (auto& g : groups_)
+		{
+			if (g.first == &exec)
+				return g.second.push_back(t);
+		}
+		groups_.emplace_back(&exec, std::vector<task*>{t});
 	}
 
-	template <typename Exception>
-	inline void set_exception(Exception&& ex)
+	void flush() noexcept
 	{
-		impl_.set_exception(
-			std::make_exception_ptr(std::forward<Exception>(ex))
-		);
-		notify();
+		for (auto& g : groups_)
+		{
+			g.first->add_batch(g.second.data(), g.second.size());
+		}
+		groups_.clear();
 	}
+};
 
-private:
-	void notify()
+// The task_batch collecting on the calling thread, if any.
+inline task_batch*& local_task_batch() noexcept
+{
+	static thread_local task_batch* batch = nullptr;
+	return batch;
+}
+
+// Hands `t` to `exec`, or to the batch collecting on this thread.
+inline void dispatch(executor& exec, task* t) noexcept
+{
+	if (auto b = local_task_batch())
 	{
-		set_ = true;
-		std::unique_lock<spinlock> lock(lock_);
-		if (future_)
+		try
 		{
-			future_->set_ready();
-			future_ = nullptr;
+			return b->add(exec, t);
 		}
-		else if (continuation_)
+		catch (...)
 		{
-			lock.unlock();
-			continuation_->run();
-			continuation_ = nullptr;
 		}
 	}
-};
-
-template <>
-struct promise<void> : public promise<> {
-	using promise<>::promise;
-	promise(promise<>&& x) : promise<>(std::move(x)) {}
-	promise() : promise<>() {}
-};
-
+	exec.add(t);
+}
 
-template <typename... T>
-struct future_impl { using type = std::future<T...>; };
-template <>
-struct future_impl<> { using type = std::future<void>; };
 
-template <typename... T>
-struct future_result { using type = std::tuple_element_t<0, std::tuple<std::decay_t<T>...> >; };
-template <>
-struct future_result<> { using type = void; };
+// The executor that owns the calling thread, if any, e.g. the reactor
+// running on it. A then() attached on such a thread to a pending future
+// resumes on it rather than on the setter's stack.
+inline executor*& local_executor() noexcept
+{
+	static thread_local executor* exec = nullptr;
+	return exec;
+}
 
-template <typename... T, typename R = typename future_result<T...>::type>
-inline R get_value_impl(std::tuple<T...>&& x) { return std::get<0>(std::move(x)); };
-template <>
-inline void get_value_impl(std::tuple<>&& x) {	return; };
 
+// State shared by a promise and its future. It is allocated once, on the
+// first get_future() or set_*() of the promise, and keeps the value or the
+// failure in place: an exception, or just an error code for failures that
+// are cheap to report. Both sides hold a reference; neither points at the
+// other, so promises and futures can be moved freely.
+//
+// The handoff is a single atomic word that only moves forward:
+//
+//   pending -> attached (a continuation is waiting)  -> result | exception
+//   pending ----------------------------------------> result | exception
+//
+// The setter publishes with one exchange and never waits; whichever side
+// arrives second runs the continuation. Blocking waiters set the `waiting`
+// bit and park on the word itself.
+//
+// The continuation lives in the state too: callables of up to
+// `continuation_size` bytes are stored in place behind a single function
+// pointer, larger ones fall back to one heap allocation. A continuation
+// bound to an executor is stored as a task, which is pushed as is onto the
+// executor's queue.
 template <typename... T>
-class future
+class future_state : public pooled
 {
 	template <typename... U>
 	friend class promise;
 	template <typename... U>
 	friend class future;
 
-private:
-	using impl_type = typename future_impl<T...>::type;
-	using result_type = typename future_result<T...>::type;
+public:
+	using value_type = std::tuple<std::decay_t<T>...>;
 
-	impl_type impl_;
-	promise<T...>* promise_{nullptr};
+	static constexpr size_t continuation_size = 8 * sizeof(void*);
 
-	enum class state
+	enum : uint32_t
 	{
-		invalid,
-		future,
-		result,
-		exception,
-	} state_{state::future};
+		pending = 0,
+		attached = 1,
+		result = 2,
+		exception = 3,
 
-	std::tuple<std::decay_t<T>... > value_;
+		status_mask = 3,
+		waiting = 4,
+	};
+
+private:
+	std::atomic<uint32_t> status_{pending};
+	std::atomic<uint32_t> refs_{1};
+	bool retrieved_{false};
+	void (*run_)(void*, future_state*){nullptr};
+	typename std::aligned_storage<continuation_size, alignof(std::max_align_t)>::type continuation_;
 	std::exception_ptr ex_{nullptr};
+	std::error_code ec_;
+	typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type value_;
 
 public:
-	future() noexcept {}
+	future_state() noexcept {}
+	future_state(const future_state&) = delete;
+	future_state& operator=(const future_state&) = delete;
 
-	future(future&& x) noexcept
-		: impl_(std::move(x.impl_)),
-		  promise_(std::exchange(x.promise_, nullptr)),
-		  state_(std::exchange(x.state_, state::invalid)),
-		  value_(std::move(x.value_)),
-		  ex_(std::move(x.ex_))
+	~future_state()
 	{
-		if (promise_)
-		{
-			promise_->future_ = this;
-		}
+		if (status() == result)
+			value().~value_type();
 	}
 
-	future(promise<T...>* pr)
-		: impl_(pr->impl_.get_future())
+	void add_ref() noexcept
 	{
-		if (pr->set_)
-		{
-			set_ready();
-		}
-		else
-		{
-			promise_ = pr;
-			promise_->future_ = this;
-		}
+		refs_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release() noexcept
+	{
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	bool ready() const noexcept
+	{
+		return status(std::memory_order_acquire) >= result;
+	}
+
+	bool failed() const noexcept
+	{
+		return status(std::memory_order_acquire) == exception;
 	}
 
 	template <typename... A>
-	future(ready_future_marker, A&&... a) noexcept
-		: value_(std::tuple<T...>(std::forward<A>(a)...)),
-		  state_(state::result)
-	{}
+	void set_value(A&&... a)
+	{
+		complete(put_value(std::forward<A>(a)...));
+	}
 
-	future(exception_future_marker, std::exception_ptr ex) noexcept
-		: ex_(std::move(ex)),
-		  state_(state::exception)
-	{}
+	void set_exception(std::exception_ptr ex)
+	{
+		complete(put_exception(std::move(ex)));
+	}
 
-	template <typename Exception>
-	future(exception_future_marker, Exception&& ex) noexcept
-		: ex_(std::make_exception_ptr(std::forward<Exception>(ex))),
-		  state_(state::exception)
-	{}
+	// Fails the state without an exception_ptr; see future::error().
+	void set_error(std::error_code ec)
+	{
+		complete(put_error(ec));
+	}
 
-	future(const future&) = delete;
+	// The halves of set_*(), for promise_batch: put_*() stores the result
+	// and returns the status to publish; publish() makes it visible and
+	// returns the previous status word, whose waiting bit and continuation
+	// the caller takes care of with wake() and resume().
+	template <typename... A>
+	uint32_t put_value(A&&... a)
+	{
+		check_pending();
+		new (&value_) value_type(std::forward<A>(a)...);
+		return result;
+	}
 
-	~future()
+	uint32_t put_exception(std::exception_ptr ex)
 	{
-		if (promise_)
-		{
-			promise_->future_ = nullptr;
-		}
+		check_pending();
+		ex_ = std::move(ex);
+		return exception;
 	}
 
-	future& operator=(const future&) = delete;
-	future& operator=(future&& x) noexcept
+	uint32_t put_error(std::error_code ec)
 	{
-		if (this != &x)
-		{
-			this->~future();
-			new (this) future(std::move(x));
-		}
-		return *this;
+		check_pending();
+		ec_ = ec;
+		return exception;
 	}
 
-	result_type get()
+	uint32_t publish(uint32_t status) noexcept
 	{
-		if (promise_)
-		{
-			auto lock = std::unique_lock<spinlock>(promise_->lock_);
+		return status_.exchange(status, std::memory_order_acq_rel);
+	}
 
-			if (state_ == state::future)
-			{
-				impl_.wait();
-				set_ready();
-				promise_->future_ = nullptr;
-				promise_ = nullptr;
-			}
-		}
+	void wake() noexcept
+	{
+		futex_wake(status_);
+	}
 
-		switch (state_)
-		{
-			case state::invalid:
-			{
-				std::error_code ec(std::make_error_code(std::future_errc::no_state));
-				throw std::future_error(ec);
-			}
-			case state::result:
-			{
-				state_ = state::invalid;
-				return get_value_impl<T...>(std::move(value_));
-			}
-			case state::exception:
-			{
-				state_ = state::invalid;
-				std::rethrow_exception(std::move(ex_));
-			}
-			case state::future:
-			default:
-				abort();
-		}
+	void resume() noexcept
+	{
+		run_(&continuation_, this);
 	}
 
-	bool valid() const
+	// A failed state holds either an exception or an error code.
+	bool has_exception() const noexcept
 	{
-		switch (state_)
-		{
-			case state::future:
-				return impl_.valid();
-			case state::result:
-			case state::exception:
-				return true;
-			default:
-				return false;
-		}
+		return ex_ != nullptr;
 	}
 
-	bool failed() const
+	// Runs `func` with the future of this state once it is ready, or right
+	// away if it already is. Takes over the caller's reference.
+	template <typename Func>
+	void schedule(Func&& func) noexcept
 	{
-		return state_ == state::exception;
+		using F = std::decay_t<Func>;
+		emplace<F>(std::forward<Func>(func), fits_inline<F>());
+		attach();
 	}
 
-	void wait() const
+	// Same, but `func` runs on `exec`.
+	template <typename Func>
+	void schedule(executor& exec, Func&& func) noexcept
 	{
-		if (state_ == state::future)
-			impl_.wait();
+		using F = std::decay_t<Func>;
+		emplace_hop<F>(exec, std::forward<Func>(func), fits_inline<hop<F, true> >());
+		attach();
 	}
 
-	template <typename U = result_type>
-	inline std::enable_if_t<!std::is_same<U, void>::value, void>
-	set_ready() noexcept
+	// Takes back the continuation attached by schedule() and destroys it
+	// without running it, along with the reference it held. Fails if the
+	// state became ready first; the continuation then runs as usual.
+	bool detach() noexcept
 	{
-		if (state_ != state::future) return;
-		try
-		{
-			value_ = std::tuple<T...>(impl_.get());
-			state_ = state::result;
-		}
-		catch (...)
+		auto st = status_.load(std::memory_order_relaxed);
+		while ((st & status_mask) == attached)
 		{
-			ex_ = std::current_exception();
-			state_ = state::exception;
+			if (status_.compare_exchange_weak(st, st & ~status_mask,
+											  std::memory_order_acquire,
+											  std::memory_order_relaxed))
+			{
+				run_(&continuation_, nullptr);
+				release();
+				return true;
+			}
 		}
+		return false;
 	}
 
-	template <typename U = result_type>
-	inline std::enable_if_t<std::is_same<U, void>::value, void>
-	set_ready() noexcept
+	void wait() noexcept
 	{
-		if (state_ != state::future) return;
-		try
+		if (ready() || spin([] { return false; })) return;
+		auto st = status_.fetch_or(waiting, std::memory_order_acquire) | waiting;
+		while ((st & status_mask) < result)
 		{
-			impl_.get();
-			state_ = state::result;
+			futex_wait(status_, st);
+			st = status_.load(std::memory_order_acquire);
 		}
-		catch (...)
+	}
+
+	template <typename Clock, typename Duration>
+	bool wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) noexcept
+	{
+		if (ready()) return true;
+		if (spin([&timeout_time] { return Clock::now() >= timeout_time; })) return true;
+		auto st = status_.fetch_or(waiting, std::memory_order_acquire) | waiting;
+		while ((st & status_mask) < result)
 		{
-			ex_ = std::current_exception();
-			state_ = state::exception;
+			auto now = Clock::now();
+			if (now >= timeout_time) break;
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout_time - now).count();
+			struct timespec ts;
+			ts.tv_sec = ns / 1000000000;
+			ts.tv_nsec = ns % 1000000000;
+			futex_wait(status_, st, &ts);
+			st = status_.load(std::memory_order_acquire);
 		}
+		return ready();
 	}
 
-	inline bool ready() const
+	value_type&& take_value() noexcept
 	{
-		return state_ == state::result || state_ == state::exception;
+		return std::move(value());
 	}
 
-	template <typename Rep, typename Period>
-	future_status wait_for(const std::chrono::duration<Rep, Period>& timeout_duration) const
+	std::exception_ptr take_exception() noexcept
 	{
-		if (state_ == state::future)
-			return static_cast<future_status>(impl_.wait_for(timeout_duration));
-		return future_status::ready;
+		return std::move(ex_);
 	}
 
-	template <typename Clock, typename Duration>
-	future_status wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) const
+	std::error_code error() const noexcept
 	{
-		if (state_ == state::future)
-			return static_cast<future_status>(impl_.wait_until(timeout_time));
-		return future_status::ready;
+		return ec_;
 	}
 
-	template <typename Func,
-			  typename Futurize = futurize<std::result_of_t<Func(future)> >,
-			  typename Result = typename Futurize::type>
-	Result then(Func&& func) noexcept
+private:
+	uint32_t status(std::memory_order order = std::memory_order_relaxed) const noexcept
+	{
+		return status_.load(order) & status_mask;
+	}
+
+	value_type& value() noexcept
+	{
+		return *reinterpret_cast<value_type*>(&value_);
+	}
+
+	// Spin and yield phases of a blocking wait, see wait_policy. Returns
+	// whether the state became ready; if not, the caller parks and the wait
+	// is counted as parked.
+	template <typename Expired>
+	bool spin(Expired expired) noexcept
+	{
+		auto& policy = local_wait_policy();
+		auto& stats = local_wait_stats();
+		for (unsigned i = 0; i < policy.spins; ++i)
+		{
+			if (i % 64 == 0 && expired())
+				break;
+			cpu_relax();
+			if (ready())
+			{
+				stats.spun++;
+				return true;
+			}
+		}
+		for (unsigned i = 0; i < policy.yields && !expired(); ++i)
+		{
+			std::this_thread::yield();
+			if (ready())
+			{
+				stats.yielded++;
+				return true;
+			}
+		}
+		stats.parked++;
+		return false;
+	}
+
+	template <typename F>
+	using fits_inline = std::integral_constant<bool,
+		sizeof(F) <= continuation_size &&
+		alignof(F) <= alignof(std::max_align_t) &&
+		std::is_nothrow_move_constructible<F>::value>;
+
+	// The callable is moved out of the state before it runs: handing it the
+	// future may drop the last reference to the state. Without a state,
+	// run_ only destroys the callable, see detach().
+	template <typename F, typename Func>
+	void emplace(Func&& func, std::true_type) noexcept
+	{
+		new (&continuation_) F(std::forward<Func>(func));
+		run_ = [](void* p, future_state* s) {
+			auto stored = static_cast<F*>(p);
+			F func(std::move(*stored));
+			stored->~F();
+			if (s)
+				func(s->make_future());
+		};
+	}
+
+	template <typename F>
+	struct boxed final : public pooled
+	{
+		template <typename Func>
+		explicit boxed(Func&& f)
+			: func(std::forward<Func>(f))
+		{}
+
+		F func;
+	};
+
+	template <typename F, typename Func>
+	void emplace(Func&& func, std::false_type)
+	{
+		new (&continuation_) boxed<F>*(new boxed<F>(std::forward<Func>(func)));
+		run_ = [](void* p, future_state* s) {
+			std::unique_ptr<boxed<F> > b(*static_cast<boxed<F>**>(p));
+			if (s)
+				b->func(s->make_future());
+		};
+	}
+
+	template <typename F, bool Inline>
+	struct hop final : public task, public pooled
+	{
+		hop(executor& exec, future_state* state, F&& func)
+			: exec_(&exec),
+			  state_(state),
+			  func_(std::move(func))
+		{}
+
+		virtual void run() noexcept override
+		{
+			F func(std::move(func_));
+			auto s = state_;
+			if (Inline)
+				this->~hop();
+			else
+				delete this;
+			func(s->make_future());
+		}
+
+		executor* exec_;
+		future_state* state_;
+		F func_;
+	};
+
+	template <typename F, typename Func>
+	void emplace_hop(executor& exec, Func&& func, std::true_type) noexcept
+	{
+		new (&continuation_) hop<F, true>(exec, this, F(std::forward<Func>(func)));
+		run_ = [](void* p, future_state* s) {
+			auto h = static_cast<hop<F, true>*>(p);
+			if (s)
+				dispatch(*h->exec_, h);
+			else
+				h->~hop();
+		};
+	}
+
+	template <typename F, typename Func>
+	void emplace_hop(executor& exec, Func&& func, std::false_type)
+	{
+		new (&continuation_) hop<F, false>*(new hop<F, false>(exec, this, F(std::forward<Func>(func))));
+		run_ = [](void* p, future_state* s) {
+			auto h = *static_cast<hop<F, false>**>(p);
+			if (s)
+				dispatch(*h->exec_, h);
+			else
+				delete h;
+		};
+	}
+
+	void attach() noexcept
+	{
+		auto st = status_.load(std::memory_order_relaxed);
+		while ((st & status_mask) == pending)
+		{
+			if (status_.compare_exchange_weak(st, st | attached,
+											  std::memory_order_release,
+											  std::memory_order_acquire))
+				return;
+		}
+		run_(&continuation_, this);
+	}
+
+	// A ready future adopting the reference held by the continuation.
+	future<T...> make_future() noexcept
+	{
+		future<T...> fut(this);
+		fut.set_ready();
+		return fut;
+	}
+
+	// Only the promise sets the state, so a plain check is race free.
+	void check_pending()
+	{
+		if (status() >= result)
+		{
+			std::error_code ec(std::make_error_code(std::future_errc::promise_already_satisfied));
+			throw std::future_error(ec);
+		}
+	}
+
+	void complete(uint32_t status) noexcept
+	{
+		auto old = publish(status);
+		if (old & waiting)
+			wake();
+		if ((old & status_mask) == attached)
+			resume();
+	}
+};
+
+
+template <typename... T>
+class promise
+{
+	template <typename... U>
+	friend class future;
+	friend class promise_batch;
+
+private:
+	future_state<T...>* state_{nullptr};
+
+public:
+	promise() noexcept {}
+
+	promise(promise&& x) noexcept
+		: state_(std::exchange(x.state_, nullptr))
+	{}
+
+	promise(const promise&) = delete;
+
+	~promise() noexcept
+	{
+		if (state_)
+		{
+			if (state_->retrieved_ && !state_->ready())
+			{
+				std::error_code ec(std::make_error_code(std::future_errc::broken_promise));
+				state_->set_exception(std::make_exception_ptr(std::future_error(ec)));
+			}
+			state_->release();
+		}
+	}
+
+	promise& operator=(promise&& x) noexcept
+	{
+		if (this != &x)
+		{
+			this->~promise();
+			new (this) promise(std::move(x));
+		}
+		return *this;
+	}
+
+	future<T...> get_future()
+	{
+		auto s = state();
+		if (s->retrieved_)
+		{
+			std::error_code ec(std::make_error_code(std::future_errc::future_already_retrieved));
+			throw std::future_error(ec);
+		}
+		s->retrieved_ = true;
+		s->add_ref();
+		return future<T...>(s);
+	}
+
+	template <typename... A>
+	inline void set_value(A&&... a)
+	{
+		state()->set_value(std::forward<A>(a)...);
+	}
+
+	inline void set_exception(std::exception_ptr ex)
+	{
+		state()->set_exception(std::move(ex));
+	}
+
+	template <typename Exception>
+	inline void set_exception(Exception&& ex)
+	{
+		state()->set_exception(
+			std::make_exception_ptr(std::forward<Exception>(ex))
+		);
+	}
+
+	inline void set_error(std::error_code ec)
+	{
+		state()->set_error(ec);
+	}
+
+	// Whether the future was retrieved and has been dropped since, e.g. as
+	// a losing input of when_any(): nobody is going to read the result.
+	bool abandoned() const noexcept
+	{
+		return state_ && state_->retrieved_ &&
+			state_->refs_.load(std::memory_order_acquire) == 1;
+	}
+
+private:
+	future_state<T...>* state()
+	{
+		if (!state_)
+			state_ = new future_state<T...>();
+		return state_;
+	}
+};
+
+// Only a pointer to the state, so queues of promises grow with a memcpy.
+template <typename... T>
+struct is_trivially_relocatable<promise<T...> > : std::true_type
+{};
+
+template <>
+struct promise<void> : public promise<> {
+	using promise<>::promise;
+	promise(promise<>&& x) : promise<>(std::move(x)) {}
+	promise() : promise<>() {}
+};
+
+
+// Completes many promises as one. Each result is published as soon as it
+// is set, but blocked waiters are only woken, and continuations only run,
+// on commit(), which the destructor calls too. By then every result of the
+// batch is visible, so a thread that waits on several of them in turn
+// sleeps and wakes once rather than once per promise. Continuations bound
+// to an executor are handed over in one add_batch() per executor.
+class promise_batch
+{
+private:
+	enum class op
+	{
+		wake,
+		resume,
+		release,
+	};
+
+	// A state with a waiter or a continuation to take care of.
+	struct entry
+	{
+		void* state;
+		uint32_t old;
+		void (*apply)(void* state, op o);
+	};
+
+	std::vector<entry> entries_;
+
+public:
+	promise_batch() = default;
+	promise_batch(const promise_batch&) = delete;
+	promise_batch& operator=(const promise_batch&) = delete;
+
+	~promise_batch()
+	{
+		commit();
+	}
+
+	template <typename... T, typename... A>
+	void set_value(promise<T...>& pr, A&&... a)
+	{
+		auto s = prepare(pr);
+		record(s, s->publish(s->put_value(std::forward<A>(a)...)));
+	}
+
+	template <typename... T>
+	void set_exception(promise<T...>& pr, std::exception_ptr ex)
+	{
+		auto s = prepare(pr);
+		record(s, s->publish(s->put_exception(std::move(ex))));
+	}
+
+	template <typename... T>
+	void set_error(promise<T...>& pr, std::error_code ec)
+	{
+		auto s = prepare(pr);
+		record(s, s->publish(s->put_error(ec)));
+	}
+
+	// Wakes the waiters first, so that they get going while the
+	// continuations run here.
+	void commit() noexcept
+	{
+		for (auto& e : entries_)
+		{
+			if (e.old & future_state<>::waiting)
+				e.apply(e.state, op::wake);
+		}
+
+		task_batch tasks;
+		auto outer = std::exchange(local_task_batch(), &tasks);
+		for (auto& e : entries_)
+		{
+			if ((e.old & future_state<>::status_mask) == future_state<>::attached)
+				e.apply(e.state, op::resume);
+		}
+		local_task_batch() = outer;
+		tasks.flush();
+
+		for (auto& e : entries_)
+		{
+			e.apply(e.state, op::release);
+		}
+		entries_.clear();
+	}
+
+private:
+	// Makes room for the entry up front: once published, a result must
+	// not lose its waiter or continuation to a failed allocation.
+	template <typename... T>
+	future_state<T...>* prepare(promise<T...>& pr)
+	{
+		if (entries_.size() == entries_.capacity())
+			entries_.reserve(std::max<size_t>(16, 2 * entries_.capacity()));
+		return pr.state();
+	}
+
+	template <typename... T>
+	void record(future_state<T...>* s, uint32_t old) noexcept
+	{
+		if (!(old & future_state<T...>::waiting) &&
+			(old & future_state<T...>::status_mask) != future_state<T...>::attached)
+			return;
+		// the waiter may take the result and drop the state before commit()
+		s->add_ref();
+		entries_.push_back(entry{s, old, &apply<T...>});
+	}
+
+	template <typename... T>
+	static void apply(void* p, op o)
+	{
+		auto s = static_cast<future_state<T...>*>(p);
+		switch (o)
+		{
+			case op::wake:
+				s->wake();
+				break;
+			case op::resume:
+				s->resume();
+				break;
+			case op::release:
+				s->release();
+				break;
+		}
+	}
+};
+
+
+// A reference to a link held by the continuation it guards, released
+// whether the continuation runs or is detached unrun.
+template <typename Link>
+struct link_ref
+{
+	Link* link;
+
+	explicit link_ref(Link* l) noexcept : link(l) {}
+	link_ref(link_ref&& x) noexcept : link(std::exchange(x.link, nullptr)) {}
+	~link_ref()
+	{
+		if (link)
+			link->release();
+	}
+	Link* operator->() const noexcept { return link; }
+};
+
+// Ties a continuation attached with then(abort_token, func) to the token.
+// The continuation and the abort race to claim the result promise; an
+// abort that wins fails it and takes the continuation back from the input
+// state, see future_state::detach(). References are held by the
+// continuation, the subscription and, while attaching, by then().
+template <typename Promise, typename... T>
+struct abort_link final : public abort_subscription, public pooled
+{
+	Promise pr;
+	abort_token token;
+	future_state<T...>* input;
+	std::atomic<bool> claimed{false};
+	std::atomic<uint32_t> refs{3};
+
+	abort_link(Promise&& p, const abort_token& t, future_state<T...>* s) noexcept
+		: pr(std::move(p)),
+		  token(t),
+		  input(s)
+	{
+		if (input)
+			input->add_ref();
+	}
+
+	~abort_link()
+	{
+		if (input)
+			input->release();
+	}
+
+	bool claim() noexcept
+	{
+		return !claimed.exchange(true, std::memory_order_acq_rel);
+	}
+
+	virtual void on_abort() noexcept override
+	{
+		if (claim())
+		{
+			pr.set_exception(abort_requested());
+			if (input)
+				input->detach();
+		}
+		release();
+	}
+
+	// Withdraws the subscription once the continuation won.
+	void unsubscribe() noexcept
+	{
+		if (token.unsubscribe(this))
+			release();
+	}
+
+	void release() noexcept
+	{
+		if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+};
+
+
+template <typename... T>
+struct future_result { using type = std::tuple_element_t<0, std::tuple<std::decay_t<T>...> >; };
+template <>
+struct future_result<> { using type = void; };
+
+template <typename... T, typename R = typename future_result<T...>::type>
+inline R get_value_impl(std::tuple<T...>&& x) { return std::get<0>(std::move(x)); };
+template <>
+inline void get_value_impl(std::tuple<>&& x) {	return; };
+
+template <typename... T>
+class future
+{
+	template <typename... U>
+	friend class promise;
+	template <typename... U>
+	friend class future;
+	template <typename... U>
+	friend struct future_awaiter;
+	template <typename Results, typename Inputs>
+	friend struct when_any_context;
+	template <typename... U>
+	friend struct timeout_link;
+	template <typename... U>
+	friend class shared_future;
+
+private:
+	using result_type = typename future_result<T...>::type;
+
+	future_state<T...>* shared_{nullptr};
+	executor* exec_{nullptr};
+
+	enum class state
+	{
+		invalid,
+		future,
+		result,
+		exception,
+		error,
+	} state_{state::invalid};
+
+	std::tuple<std::decay_t<T>... > value_;
+	std::exception_ptr ex_{nullptr};
+	std::error_code ec_;
+
+public:
+	future() noexcept {}
+
+	future(future&& x) noexcept
+		: shared_(std::exchange(x.shared_, nullptr)),
+		  exec_(std::exchange(x.exec_, nullptr)),
+		  state_(std::exchange(x.state_, state::invalid)),
+		  value_(std::move(x.value_)),
+		  ex_(std::move(x.ex_)),
+		  ec_(x.ec_)
+	{}
+
+	explicit future(future_state<T...>* s) noexcept
+		: shared_(s),
+		  state_(state::future)
+	{}
+
+	template <typename... A>
+	future(ready_future_marker, A&&... a) noexcept
+		: state_(state::result),
+		  value_(std::tuple<T...>(std::forward<A>(a)...))
+	{}
+
+	future(exception_future_marker, std::exception_ptr ex) noexcept
+		: state_(state::exception),
+		  ex_(std::move(ex))
+	{}
+
+	template <typename Exception>
+	future(exception_future_marker, Exception&& ex) noexcept
+		: state_(state::exception),
+		  ex_(std::make_exception_ptr(std::forward<Exception>(ex)))
+	{}
+
+	future(error_future_marker, std::error_code ec) noexcept
+		: state_(state::error),
+		  ec_(ec)
+	{}
+
+	future(const future&) = delete;
+
+	~future()
+	{
+		if (shared_)
+		{
+			shared_->release();
+		}
+	}
+
+	future& operator=(const future&) = delete;
+	future& operator=(future&& x) noexcept
+	{
+		if (this != &x)
+		{
+			this->~future();
+			new (this) future(std::move(x));
+		}
+		return *this;
+	}
+
+	result_type get()
+	{
+		if (state_ == state::future)
+		{
+			shared_->wait();
+			set_ready();
+		}
+
+		switch (state_)
+		{
+			case state::invalid:
+			{
+				std::error_code ec(std::make_error_code(std::future_errc::no_state));
+				throw std::future_error(ec);
+			}
+			case state::result:
+			{
+				state_ = state::invalid;
+				return get_value_impl<T...>(std::move(value_));
+			}
+			case state::exception:
+			{
+				state_ = state::invalid;
+				std::rethrow_exception(std::move(ex_));
+			}
+			case state::error:
+			{
+				state_ = state::invalid;
+				throw std::system_error(ec_);
+			}
+			case state::future:
+			default:
+				abort();
+		}
+	}
+
+	bool valid() const
+	{
+		return state_ != state::invalid;
+	}
+
+	bool failed() const
+	{
+		if (state_ == state::future)
+			return shared_->failed();
+		return state_ == state::exception || state_ == state::error;
+	}
+
+	// The error code this future failed with, without throwing; empty if
+	// it is pending, succeeded or failed with an exception.
+	std::error_code error() const noexcept
+	{
+		if (state_ == state::future)
+			return failed() && !shared_->has_exception() ? shared_->error() : std::error_code();
+		return state_ == state::error ? ec_ : std::error_code();
+	}
+
+	void wait() const
+	{
+		if (state_ == state::future)
+			shared_->wait();
+	}
+
+	// Moves the result out of the shared state, once it is there, and
+	// drops the reference to it.
+	inline void set_ready() noexcept
+	{
+		if (state_ != state::future || !shared_->ready()) return;
+		if (shared_->failed() && !shared_->has_exception())
+		{
+			ec_ = shared_->error();
+			state_ = state::error;
+		}
+		else if (shared_->failed())
+		{
+			ex_ = shared_->take_exception();
+			state_ = state::exception;
+		}
+		else
+		{
+			value_ = shared_->take_value();
+			state_ = state::result;
+		}
+		std::exchange(shared_, nullptr)->release();
+	}
+
+	inline bool ready() const
+	{
+		if (state_ == state::future)
+			return shared_->ready();
+		return state_ == state::result || state_ == state::exception || state_ == state::error;
+	}
+
+	template <typename Rep, typename Period>
+	future_status wait_for(const std::chrono::duration<Rep, Period>& timeout_duration) const
 	{
-		std::unique_lock<spinlock> lock;
-		if (promise_)
-		{
-			lock = std::unique_lock<spinlock>(promise_->lock_);
-		}
+		return wait_until(std::chrono::steady_clock::now() + timeout_duration);
+	}
+
+	template <typename Clock, typename Duration>
+	future_status wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) const
+	{
+		if (state_ == state::future && !shared_->wait_until(timeout_time))
+			return future_status::timeout;
+		return future_status::ready;
+	}
+
+	template <typename Func,
+			  typename Futurize = futurize<std::result_of_t<Func(future)> >,
+			  typename Result = typename Futurize::type>
+	Result then(Func&& func) noexcept
+	{
+		if (exec_)
+			return then(*exec_, std::forward<Func>(func));
+
+		set_ready();
 
 		switch (state_)
 		{
 			case state::result:
 			case state::exception:
+			case state::error:
 			{
-				if (promise_) lock.unlock();
-				promise_ = nullptr;
-				try
-				{
-					return Futurize::apply(std::forward<Func>(func), std::move(*this));
-				}
-				catch (...)
-				{
-					return Result(exception_future_marker(), std::current_exception());
-				}
+				return Futurize::apply(std::forward<Func>(func), std::move(*this));
 			}
 			case state::future:
 			{
 				typename Futurize::promise_type pr;
 				auto fut = pr.get_future();
 
+				auto cont = wrap<Futurize>(std::move(pr), std::forward<Func>(func));
+				if (auto exec = local_executor())
+					schedule(*exec, std::move(cont));
+				else
+					schedule(std::move(cont));
+				return fut;
+			}
+			default:
+				abort();
+		}
+	}
+
+	// Like then(func), but `func` runs on `exec`, even when this future is
+	// ready already. A pending future hands its stored continuation to the
+	// executor, so the hop costs a single queue push.
+	template <typename Func,
+			  typename Futurize = futurize<std::result_of_t<Func(future)> >,
+			  typename Result = typename Futurize::type>
+	Result then(executor& exec, Func&& func) noexcept
+	{
+		exec_ = nullptr;
+		typename Futurize::promise_type pr;
+		auto fut = pr.get_future();
+		auto cont = wrap<Futurize>(std::move(pr), std::forward<Func>(func));
+
+		set_ready();
+
+		switch (state_)
+		{
+			case state::result:
+			case state::exception:
+			case state::error:
+			{
+				exec.add(make_task(
+					[cont = std::move(cont), f = std::move(*this)]() mutable {
+						cont(std::move(f));
+					}
+				));
+				break;
+			}
+			case state::future:
+			{
+				schedule(exec, std::move(cont));
+				break;
+			}
+			default:
+				abort();
+		}
+		return fut;
+	}
+
+	// Like then(func), but aborting `token` fails the returned future with
+	// abort_requested right away and destroys `func` without running it,
+	// unless this future got ready first. A continuation that has been
+	// queued on an executor cannot be taken back; it is destroyed, unrun,
+	// when its turn comes.
+	template <typename Func,
+			  typename Futurize = futurize<std::result_of_t<Func(future)> >,
+			  typename Result = typename Futurize::type>
+	Result then(const abort_token& token, Func&& func) noexcept
+	{
+		if (token.requested())
+			return Result(exception_future_marker(), abort_requested());
+
+		set_ready();
+		auto exec = std::exchange(exec_, nullptr);
+		if (state_ != state::future && !exec)
+			return then(std::forward<Func>(func));
+
+		using link = abort_link<typename Futurize::promise_type, T...>;
+		typename Futurize::promise_type pr;
+		auto fut = pr.get_future();
+		auto l = new link(std::move(pr), token, shared_);
+		if (!token.subscribe(l))
+			l->on_abort();
+
+		auto cont = [r = link_ref<link>(l), func = std::forward<Func>(func)](future f) mutable {
+			if (!r->claim())
+				return;
+			r->unsubscribe();
+			Futurize::apply(func, std::move(f)).forward_to(std::move(r->pr));
+		};
+
+		if (state_ == state::future)
+		{
+			if (!exec)
+				exec = local_executor();
+			if (exec)
+				schedule(*exec, std::move(cont));
+			else
+				schedule(std::move(cont));
+			// an abort that came before the continuation was attached
+			// could not take it back yet
+			if (token.requested())
+				l->input->detach();
+		}
+		else
+		{
+			exec->add(make_task(
+				[cont = std::move(cont), f = std::move(*this)]() mutable {
+					cont(std::move(f));
+				}
+			));
+		}
+		l->release();
+		return fut;
+	}
+
+	// Continuations attached to the returned future run on `exec`.
+	future via(executor& exec) noexcept
+	{
+		exec_ = &exec;
+		return std::move(*this);
+	}
+
+	// Resolves `pr` with this future's result, now or once it is ready.
+	void forward_to(promise<T...>&& pr) noexcept
+	{
+		set_ready();
+
+		switch (state_)
+		{
+			case state::result:
+			{
+				state_ = state::invalid;
+				pr.state()->set_value(std::move(value_));
+				break;
+			}
+			case state::exception:
+			{
+				state_ = state::invalid;
+				pr.state()->set_exception(std::move(ex_));
+				break;
+			}
+			case state::error:
+			{
+				state_ = state::invalid;
+				pr.state()->set_error(ec_);
+				break;
+			}
+			case state::future:
+			{
 				schedule(
-					[pr = std::move(pr), func = std::forward<Func>(func)](future f) mutable {
-						try
-						{
-							Futurize::apply(func, std::move(f)).forward_to(pr);
-						}
-						catch (...)
-						{
-							pr.set_exception(std::current_exception());
-						}
+					[pr = std::move(pr)](future f) mutable {
+						f.forward_to(std::move(pr));
 					}
 				);
-				return fut;
+				break;
 			}
 			default:
 				abort();
 		}
 	}
 
-private:
-	template <typename Func>
-	void schedule(Func&& func)
+	// Hands this future to func(future) once it is ready: right away if it
+	// is, otherwise on the thread that completes it. Unlike then() there is
+	// no result future to allocate, so func must not throw.
+	template <typename Func>
+	void on_ready(Func&& func) noexcept
+	{
+		set_ready();
+		if (state_ == state::future)
+			schedule(std::forward<Func>(func));
+		else
+			func(std::move(*this));
+	}
+
+	// Turns this future into one that any number of readers can share.
+	shared_future<T...> share() noexcept;
+
+private:
+	// Futurize::apply() catches what `func` throws, and forward_to() does
+	// not throw, so there is nothing left to catch here.
+	template <typename Futurize, typename Func>
+	static auto wrap(typename Futurize::promise_type&& pr, Func&& func)
+	{
+		return [pr = std::move(pr), func = std::forward<Func>(func)](future f) mutable {
+			Futurize::apply(func, std::move(f)).forward_to(std::move(pr));
+		};
+	}
+
+	template <typename... Args>
+	void schedule(Args&&... args) noexcept
+	{
+		state_ = state::invalid;
+		std::exchange(shared_, nullptr)->schedule(std::forward<Args>(args)...);
+	}
+};
+
+template <>
+struct future<void> : public future<>
+{
+	using future<>::future;
+	future(future<>&& x) : future<>(std::move(x)) {}
+	future() : future<>() {}
+};
+
+
+template <typename... T>
+inline future<T...> make_ready_future(T&&... value) noexcept
+{
+	return future<T...>(ready_future_marker(), std::forward<T>(value)...);
+}
+
+template <std::size_t N>
+inline future<std::string> make_ready_future(const char(&ar)[N]) noexcept
+{
+	return future<std::string>(ready_future_marker(), ar);
+}
+
+template <typename... T>
+inline future<T...> make_exception_future(std::exception_ptr ex) noexcept
+{
+	return future<T...>(exception_future_marker(), ex);
+}
+
+template <typename... T, typename Exception>
+inline future<T...> make_exception_future(Exception&& ex) noexcept
+{
+	return make_exception_future<T...>(std::make_exception_ptr(std::forward<Exception>(ex)));
+}
+
+// A failed future that carries `ec` instead of an exception: it is only
+// thrown, as std::system_error, by get(). Cheap to create and to pass on
+// through then(), for errors that are expected to be frequent.
+template <typename... T>
+inline future<T...> make_error_future(std::error_code ec) noexcept
+{
+	return future<T...>(error_future_marker(), ec);
+}
+
+
+template <bool... B>
+using all_true = std::is_same<std::integer_sequence<bool, true, B...>,
+							  std::integer_sequence<bool, B..., true> >;
+
+// Whether func(args...) is declared not to throw. futurize calls such
+// functions without a try block, so a chain of noexcept continuations
+// carries no exception handling at all.
+template <typename Func, typename... Args>
+using is_nothrow_call = std::integral_constant<bool,
+	noexcept(std::declval<Func>()(std::declval<Args>()...))>;
+
+template <typename... T>
+struct futurize
+{
+	using type = future<T...>;
+	using promise_type = promise<T...>;
+
+	// Moving the result into the future must not throw either.
+	template <typename Func, typename... Args>
+	using nothrow = std::integral_constant<bool,
+		is_nothrow_call<Func, Args...>::value &&
+		all_true<std::is_nothrow_move_constructible<std::decay_t<T> >::value...>::value>;
+
+	template <typename Func, typename... Args>
+	static inline type apply(Func&& func, Args&&... args) noexcept
+	{
+		return call(nothrow<Func, Args...>(), std::forward<Func>(func), std::forward<Args>(args)...);
+	}
+
+	static inline type convert(T&&... value)
+	{
+		return make_ready_future<T...>(std::move(value)...);
+	}
+
+private:
+	template <typename Func, typename... Args>
+	static inline type call(std::true_type, Func&& func, Args&&... args) noexcept
+	{
+		return invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename Func, typename... Args>
+	static inline type call(std::false_type, Func&& func, Args&&... args) noexcept
+	{
+		try
+		{
+			return invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			return make_exception_future<T...>(std::current_exception());
+		}
+	}
+
+	template <typename Func, typename... Args>
+	static inline std::enable_if_t<!std::is_same<std::result_of_t<Func(Args...)>, void>::value, type>
+	invoke(Func&& func, Args&&... args)
+	{
+		return convert(std::forward<Func>(func)(std::forward<Args>(args)...));
+	}
+
+	template <typename Func, typename... Args>
+	static inline std::enable_if_t<std::is_same<std::result_of_t<Func(Args...)>, void>::value, type>
+	invoke(Func&& func, Args&&... args)
+	{
+		std::forward<Func>(func)(std::forward<Args>(args)...);
+		return convert();
+	}
+};
+
+template <typename... T>
+struct futurize<future<T...> >
+{
+	using type = future<T...>;
+	using promise_type = promise<T...>;
+
+	template <typename Func, typename... Args>
+	static inline type apply(Func&& func, Args&&... args) noexcept
+	{
+		return call(is_nothrow_call<Func, Args...>(), std::forward<Func>(func), std::forward<Args>(args)...);
+	}
+
+	static inline type convert(type&& value)
+	{
+		return std::move(value);
+	}
+
+private:
+	template <typename Func, typename... Args>
+	static inline type call(std::true_type, Func&& func, Args&&... args) noexcept
+	{
+		return std::forward<Func>(func)(std::forward<Args>(args)...);
+	}
+
+	template <typename Func, typename... Args>
+	static inline type call(std::false_type, Func&& func, Args&&... args) noexcept
+	{
+		try
+		{
+			return std::forward<Func>(func)(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			return make_exception_future<T...>(std::current_exception());
+		}
+	}
+};
+
+template <>
+class futurize<void> : public futurize<> {};
+
+
+template <typename... T>
+struct shared_result
+{
+	using type = const std::tuple_element_t<0, std::tuple<std::decay_t<T>...> >&;
+
+	static type get(const std::tuple<std::decay_t<T>...>& value) noexcept
+	{
+		return std::get<0>(value);
+	}
+};
+
+template <>
+struct shared_result<>
+{
+	using type = void;
+
+	static void get(const std::tuple<>&) noexcept {}
+};
+
+
+// State of a shared_future: the result, kept once for all readers, and the
+// continuations waiting for it. These are pushed onto a lock-free intrusive
+// list; completing the state closes the list and runs what it took over,
+// in the order of attachment. Each continuation node holds a reference.
+template <typename... T>
+class shared_state : public pooled
+{
+public:
+	struct node : public task
+	{
+		node* next_{nullptr};
+		executor* exec_{nullptr};
+		shared_state* state_{nullptr};
+	};
+
+private:
+	enum : uint32_t
+	{
+		pending = 0,
+		ready = 1,
+		waiting = 2,
+	};
+
+	std::atomic<uint32_t> status_{pending};
+	std::atomic<uint32_t> refs_{1};
+	std::atomic<node*> head_{nullptr};
+	future<T...> result_;
+
+	static node* closed() noexcept
+	{
+		return reinterpret_cast<node*>(uintptr_t(1));
+	}
+
+public:
+	void add_ref() noexcept
+	{
+		refs_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release() noexcept
+	{
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	bool is_ready() const noexcept
+	{
+		return status_.load(std::memory_order_acquire) & ready;
+	}
+
+	// Only valid once ready.
+	const future<T...>& result() const noexcept
+	{
+		return result_;
+	}
+
+	// Takes over a ready future and runs the continuations attached so far.
+	void complete(future<T...>&& f) noexcept
+	{
+		result_ = std::move(f);
+		auto old = status_.exchange(ready, std::memory_order_acq_rel);
+		if (old & waiting)
+			futex_wake(status_);
+
+		node* reversed = nullptr;
+		for (auto n = head_.exchange(closed(), std::memory_order_acq_rel); n; )
+		{
+			auto next = n->next_;
+			n->next_ = reversed;
+			reversed = n;
+			n = next;
+		}
+		while (reversed)
+		{
+			auto n = std::exchange(reversed, reversed->next_);
+			fire(n);
+		}
+	}
+
+	// Runs `n` once the state is ready, or right away if it is.
+	void attach(node* n) noexcept
 	{
-		auto tmp = promise_;
-		promise_ = nullptr;
-		tmp->continuation_ = std::make_unique<continuation<Func, future> >(
-			std::forward<Func>(func), std::move(*this)
-		);
-		tmp->future_ = nullptr;
+		add_ref();
+		n->state_ = this;
+		n->next_ = head_.load(std::memory_order_acquire);
+		do
+		{
+			if (n->next_ == closed())
+				return fire(n);
+		}
+		while (!head_.compare_exchange_weak(n->next_, n,
+											std::memory_order_release,
+											std::memory_order_acquire));
 	}
 
-	template <typename U = result_type>
-	inline std::enable_if_t<!std::is_same<U, void>::value, void>
-	forward_to(promise<T...>& pr)
+	void wait() noexcept
 	{
-		pr.set_value(get());
+		if (is_ready()) return;
+		auto st = status_.fetch_or(waiting, std::memory_order_acquire) | waiting;
+		while (!(st & ready))
+		{
+			futex_wait(status_, st);
+			st = status_.load(std::memory_order_acquire);
+		}
 	}
 
-	template<typename U = result_type>
-	inline std::enable_if_t<std::is_same<U, void>::value, void>
-	forward_to(promise<T...>& pr)
+private:
+	static void fire(node* n) noexcept
 	{
-		get();
-		pr.set_value();
+		if (n->exec_)
+			dispatch(*n->exec_, n);
+		else
+			n->run();
 	}
-
-};
-
-template <>
-struct future<void> : public future<>
-{
-	using future<>::future;
-	future(future<>&& x) : future<>(std::move(x)) {}
-	future() : future<>() {}
 };
 
 
+// A future that any number of readers can hold and attach continuations
+// to, from future::share(). The result is stored once: get() returns a
+// const reference to it, and every continuation is handed the same
+// shared_future, so fanning out copies nothing. Copying a shared_future
+// only takes another reference.
 template <typename... T>
-inline future<T...> make_ready_future(T&&... value) noexcept
+class shared_future
 {
-	return future<T...>(ready_future_marker(), std::forward<T>(value)...);
-}
+private:
+	using state_type = shared_state<T...>;
+	using result_type = typename future_result<T...>::type;
 
-template <std::size_t N>
-inline future<std::string> make_ready_future(const char(&ar)[N]) noexcept
-{
-	return future<std::string>(ready_future_marker(), ar);
-}
+	state_type* state_{nullptr};
 
-template <typename... T>
-inline future<T...> make_exception_future(std::exception_ptr ex) noexcept
-{
-	return future<T...>(exception_future_marker(), ex);
-}
+public:
+	shared_future() noexcept {}
 
-template <typename... T, typename Exception>
-inline future<T...> make_exception_future(Exception&& ex) noexcept
-{
-	return make_exception_future<T...>(std::make_exception_ptr(std::forward<Exception>(ex)));
-}
+	// Adopts a reference to `s`.
+	explicit shared_future(state_type* s) noexcept
+		: state_(s)
+	{}
 
+	shared_future(const shared_future& x) noexcept
+		: state_(x.state_)
+	{
+		if (state_)
+			state_->add_ref();
+	}
 
-template <typename... T>
-struct futurize
-{
-	using type = future<T...>;
-	using promise_type = promise<T...>;
+	shared_future(shared_future&& x) noexcept
+		: state_(std::exchange(x.state_, nullptr))
+	{}
 
-	template <typename Func, typename Arg>
-	static inline std::enable_if_t<!std::is_same<std::result_of_t<Func(Arg)>, void>::value, type>
-	apply(Func&& func, Arg&& arg) noexcept
+	~shared_future()
 	{
-		try
-		{
-			return convert(std::forward<Func>(func)(std::forward<Arg>(arg)));
-		}
-		catch (...)
-		{
-			return make_exception_future<T...>(std::current_exception());
-		}
+		if (state_)
+			state_->release();
 	}
 
-	template <typename Func, typename Arg>
-	static inline std::enable_if_t<std::is_same<std::result_of_t<Func(Arg)>, void>::value, type>
-	apply(Func&& func, Arg&& arg) noexcept
+	shared_future& operator=(shared_future x) noexcept
 	{
-		try
-		{
-			std::forward<Func>(func)(std::forward<Arg>(arg));
-			return convert();
-		}
-		catch (...)
-		{
-			return make_exception_future<T...>(std::current_exception());
-		}
+		std::swap(state_, x.state_);
+		return *this;
 	}
 
-	static inline type convert(T&&... value)
+	bool valid() const noexcept
 	{
-		return make_ready_future<T...>(std::move(value)...);
+		return state_ != nullptr;
 	}
-};
 
-template <typename... T>
-struct futurize<future<T...> >
-{
-	using type = future<T...>;
-	using promise_type = promise<T...>;
+	bool ready() const noexcept
+	{
+		return state_ && state_->is_ready();
+	}
 
-	template <typename Func, typename Arg>
-	static inline type apply(Func&& func, Arg&& arg) noexcept
+	bool failed() const noexcept
 	{
-		try
+		return ready() && state_->result().failed();
+	}
+
+	std::error_code error() const noexcept
+	{
+		return ready() ? state_->result().error() : std::error_code();
+	}
+
+	void wait() const
+	{
+		check_valid();
+		state_->wait();
+	}
+
+	// Blocks until ready; throws the failure for every caller.
+	typename shared_result<T...>::type get() const
+	{
+		wait();
+		auto& r = state_->result();
+		switch (r.state_)
 		{
-			return convert(std::forward<Func>(func)(std::forward<Arg>(arg)));
+			case future<T...>::state::result:
+				return shared_result<T...>::get(r.value_);
+			case future<T...>::state::exception:
+				std::rethrow_exception(r.ex_);
+			case future<T...>::state::error:
+				throw std::system_error(r.ec_);
+			default:
+				abort();
 		}
-		catch (...)
+	}
+
+	// Runs func(const shared_future&) once the result is there: right away
+	// if it is, otherwise on the thread that completes it, or on the
+	// executor of the calling thread like future::then().
+	template <typename Func,
+			  typename Futurize = futurize<std::result_of_t<Func(const shared_future&)> >,
+			  typename Result = typename Futurize::type>
+	Result then(Func&& func) const
+	{
+		check_valid();
+		auto exec = local_executor();
+		if (!exec && ready())
+			return Futurize::apply(std::forward<Func>(func), *this);
+		return attach<Futurize>(exec, std::forward<Func>(func));
+	}
+
+	// Same, but `func` always runs on `exec`.
+	template <typename Func,
+			  typename Futurize = futurize<std::result_of_t<Func(const shared_future&)> >,
+			  typename Result = typename Futurize::type>
+	Result then(executor& exec, Func&& func) const
+	{
+		check_valid();
+		return attach<Futurize>(&exec, std::forward<Func>(func));
+	}
+
+	// A future of its own holding a copy of the result.
+	future<result_type> get_future() const
+	{
+		return then(
+			[](const shared_future& f) -> result_type {
+				return f.get();
+			}
+		);
+	}
+
+private:
+	template <typename Futurize, typename Func>
+	struct continuation final : public state_type::node, public pooled
+	{
+		typename Futurize::promise_type pr_;
+		Func func_;
+
+		continuation(typename Futurize::promise_type&& pr, Func&& func)
+			: pr_(std::move(pr)),
+			  func_(std::move(func))
+		{}
+
+		virtual void run() noexcept override
 		{
-			return make_exception_future<T...>(std::current_exception());
+			std::unique_ptr<continuation> self(this);
+			shared_future f(this->state_);
+			Futurize::apply(func_, static_cast<const shared_future&>(f)).forward_to(std::move(pr_));
 		}
+	};
+
+	template <typename Futurize, typename Func>
+	typename Futurize::type attach(executor* exec, Func&& func) const
+	{
+		typename Futurize::promise_type pr;
+		auto fut = pr.get_future();
+		auto c = new continuation<Futurize, std::decay_t<Func> >(std::move(pr), std::forward<Func>(func));
+		c->exec_ = exec;
+		state_->attach(c);
+		return fut;
 	}
 
-	static inline type convert(type&& value)
+	void check_valid() const
 	{
-		return std::move(value);
+		if (!state_)
+		{
+			std::error_code ec(std::make_error_code(std::future_errc::no_state));
+			throw std::future_error(ec);
+		}
 	}
 };
 
-template <>
-class futurize<void> : public futurize<> {};
+template <typename... T>
+inline shared_future<T...> future<T...>::share() noexcept
+{
+	auto s = new shared_state<T...>();
+	s->add_ref();
+	on_ready(
+		[s](future f) {
+			s->complete(std::move(f));
+			s->release();
+		}
+	);
+	return shared_future<T...>(s);
+}
 
 
-template <typename... Futures>
-struct when_all_context
+// Runs `func` on `exec`. A future returned by `func` is flattened into the
+// result.
+template <typename Func,
+		  typename Futurize = futurize<std::result_of_t<Func()> >,
+		  typename Result = typename Futurize::type>
+inline Result async(executor& exec, Func&& func)
+{
+	typename Futurize::promise_type pr;
+	auto fut = pr.get_future();
+	exec.add(make_task(
+		[pr = std::move(pr), func = std::forward<Func>(func)]() mutable {
+			Futurize::apply(func).forward_to(std::move(pr));
+		}
+	));
+	return fut;
+}
+
+// Like async(exec, func), but aborting `token` before `func` has started
+// fails the returned future with abort_requested right away.
+template <typename Func,
+		  typename Futurize = futurize<std::result_of_t<Func()> >,
+		  typename Result = typename Futurize::type>
+inline Result async(executor& exec, const abort_token& token, Func&& func)
+{
+	using F = std::decay_t<Func>;
+	return make_ready_future<>().via(exec).then(token,
+		[func = std::forward<Func>(func)](future<>) mutable noexcept(is_nothrow_call<F&>::value) {
+			return func();
+		}
+	);
+}
+
+
+// Shared by the inputs of a when_all(). Each input stores its future and
+// counts down once it is ready; the last one resolves the promise and frees
+// the context. The count starts one higher so that inputs which are ready
+// already cannot finish it while the rest are still being attached.
+template <typename Results>
+struct when_all_context : public pooled
 {
-	using type = std::tuple<Futures...>;
-	type results;
-	promise<type> pro;
+	Results results;
+	promise<Results> pr;
+	std::atomic<size_t> remaining;
+
+	when_all_context(size_t n, Results&& r)
+		: results(std::move(r)),
+		  remaining(n + 1)
+	{}
 
-	when_all_context() = default;
-	~when_all_context()
+	void done() noexcept
 	{
-		pro.set_value(std::move(results));
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			pr.set_value(std::move(results));
+			delete this;
+		}
 	}
 };
 
-template <template <typename...> class T, typename... Ts>
-inline void when_all_helper(const std::shared_ptr<T<Ts...> >&)
+template <size_t I, typename Context>
+inline void when_all_helper(Context*)
 {
 }
 
-template <template <typename...> class T, typename... Ts,
-		  typename Head, typename... Tail>
-inline void when_all_helper(const std::shared_ptr<T<Ts...> >& ctx,
-					 Head&& head, Tail&&... tail)
+template <size_t I, typename Context, typename Head, typename... Tail>
+inline void when_all_helper(Context* ctx, Head&& head, Tail&&... tail)
 {
-	auto t = head.then(
-		[ctx](Head f) {
-			std::get<sizeof...(Ts) - sizeof...(Tail) - 1>(ctx->results) = std::move(f);
+	head.on_ready(
+		[ctx](auto f) {
+			std::get<I>(ctx->results) = std::move(f);
+			ctx->done();
 		}
 	);
-	when_all_helper(ctx, std::forward<Tail>(tail)...);
+	when_all_helper<I + 1>(ctx, std::forward<Tail>(tail)...);
 }
 
 // variadic version when_all
@@ -630,9 +1978,12 @@ template <typename... Futures>
 inline future<std::tuple<Futures...> >
 when_all(Futures&&... futs)
 {
-	auto ctx = std::make_shared<when_all_context<Futures...> >();
-	when_all_helper(ctx, std::forward<Futures>(futs)...);
-	return ctx->pro.get_future();
+	auto ctx = new when_all_context<std::tuple<Futures...> >(
+		sizeof...(Futures), std::tuple<Futures...>());
+	auto fut = ctx->pr.get_future();
+	when_all_helper<0>(ctx, std::forward<Futures>(futs)...);
+	ctx->done();
+	return fut;
 }
 
 // iterator version when_all
@@ -641,60 +1992,128 @@ template <typename Iterator,
 inline future<std::vector<T> >
 when_all(Iterator begin, Iterator end)
 {
-	struct context
-	{
-		promise<std::vector<T> > pro;
-		std::vector<T> results;
-
-		context(int n) : results(n) {}
-		~context()
-		{
-			pro.set_value(std::move(results));
-		}
-	};
-
-	auto ctx = std::make_shared<context>(std::distance(begin, end));
+	size_t n = std::distance(begin, end);
+	auto ctx = new when_all_context<std::vector<T> >(n, std::vector<T>(n));
+	auto fut = ctx->pr.get_future();
 	for (size_t i = 0; begin != end; ++begin, ++i)
 	{
-		begin->then(
-			[i, ctx](auto fut) {
-				ctx->results[i] = std::move(fut);
+		begin->on_ready(
+			[ctx, i](auto f) {
+				ctx->results[i] = std::move(f);
+				ctx->done();
 			}
 		);
 	}
-	return ctx->pro.get_future();
+	ctx->done();
+	return fut;
 }
 
 
-template <typename... Futures>
-struct when_any_context
+// Shared by the inputs of a when_any(). The first input to become ready
+// wins: it resolves the promise, then the continuations still attached to
+// the other inputs are taken back and their futures dropped, which the
+// producers can see through promise::abandoned(). The context holds a
+// reference to every pending input so that detaching never races with the
+// input's state going away, and it is freed as soon as the last
+// continuation has run or been detached.
+//
+// Detaching starts once both the winner is known and every input has been
+// attached, whichever comes last. It fails for the winner, whose state is
+// ready already.
+struct when_any_input
+{
+	void* state;
+	// Detaches the continuation if there still is one and drops the
+	// reference; returns whether it detached.
+	bool (*drop)(void* state) noexcept;
+};
+
+template <typename Results, typename Inputs>
+struct when_any_context : public pooled
 {
-	using type = std::tuple<Futures...>;
-	type results;
-	promise<type> pro;
+	Results results;
+	promise<Results> pr;
+	Inputs inputs;
+	size_t count{0};
 	std::atomic<bool> done{false};
+	std::atomic<uint32_t> steps{2};
+	std::atomic<size_t> refs{1};
+
+	explicit when_any_context(Results&& r, Inputs&& i = Inputs())
+		: results(std::move(r)),
+		  inputs(std::move(i))
+	{}
+
+	// Registers a pending input and hands its future a continuation that
+	// stores it in `results` through `store`, if it wins.
+	template <typename Future, typename Store>
+	void attach(Future&& fut, Store store) noexcept
+	{
+		using state_type = std::remove_pointer_t<decltype(fut.shared_)>;
+		fut.set_ready();
+		if (done.load(std::memory_order_acquire))
+		{
+			std::decay_t<Future> loser(std::move(fut));
+			return;
+		}
+		refs.fetch_add(1, std::memory_order_relaxed);
+		if (fut.shared_)
+		{
+			fut.shared_->add_ref();
+			inputs[count++] = when_any_input{fut.shared_, [](void* p) noexcept {
+				auto s = static_cast<state_type*>(p);
+				auto detached = s->detach();
+				s->release();
+				return detached;
+			}};
+		}
+		fut.on_ready(
+			[this, store](auto f) {
+				if (!done.exchange(true, std::memory_order_acq_rel))
+				{
+					store(results, std::move(f));
+					pr.set_value(std::move(results));
+					cancel();
+				}
+				release();
+			}
+		);
+	}
+
+	// Called by the winner and once all inputs are attached.
+	void cancel() noexcept
+	{
+		if (steps.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (inputs[i].drop(inputs[i].state))
+				release();
+		}
+		count = 0;
+	}
+
+	void release() noexcept
+	{
+		if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
 };
 
-template <template <typename...> class T, typename... Ts>
-inline void when_any_helper(const std::shared_ptr<T<Ts...> >&)
+template <size_t I, typename Context>
+inline void when_any_helper(Context*)
 {
 }
 
-template <template <typename...> class T, typename... Ts,
-		  typename Head, typename... Tail>
-inline void when_any_helper(const std::shared_ptr<T<Ts...> >& ctx,
-					 Head&& head, Tail&&... tail)
+template <size_t I, typename Context, typename Head, typename... Tail>
+inline void when_any_helper(Context* ctx, Head&& head, Tail&&... tail)
 {
-	auto t = head.then(
-		[ctx](Head f) {
-			if (!ctx->done.exchange(true))
-			{
-				std::get<sizeof...(Ts) - sizeof...(Tail) - 1>(ctx->results) = std::move(f);
-				ctx->pro.set_value(std::move(ctx->results));
-			}
+	ctx->attach(head,
+		[](auto& results, auto&& f) {
+			std::get<I>(results) = std::move(f);
 		}
 	);
-	when_any_helper(ctx, std::forward<Tail>(tail)...);
+	when_any_helper<I + 1>(ctx, std::forward<Tail>(tail)...);
 }
 
 // variadic version when_any
@@ -702,9 +2121,14 @@ template <typename... Futures>
 inline future<std::tuple<Futures...> >
 when_any(Futures&&... futs)
 {
-	auto ctx = std::make_shared<when_any_context<Futures...> >();
-	when_any_helper(ctx, std::forward<Futures>(futs)...);
-	return ctx->pro.get_future();
+	using context = when_any_context<std::tuple<Futures...>,
+		std::array<when_any_input, sizeof...(Futures)> >;
+	auto ctx = new context(std::tuple<Futures...>());
+	auto fut = ctx->pr.get_future();
+	when_any_helper<0>(ctx, std::forward<Futures>(futs)...);
+	ctx->cancel();
+	ctx->release();
+	return fut;
 }
 
 // iterator version when_any
@@ -713,36 +2137,257 @@ template <typename Iterator,
 inline future<std::vector<T> >
 when_any(Iterator begin, Iterator end)
 {
-	struct context
+	using context = when_any_context<std::vector<T>, std::vector<when_any_input> >;
+	size_t n = std::distance(begin, end);
+	auto ctx = new context(std::vector<T>(n), std::vector<when_any_input>(n));
+	auto fut = ctx->pr.get_future();
+	for (size_t i = 0; begin != end; ++begin, ++i)
 	{
-		promise<std::vector<T> > pro;
-		std::vector<T> results;
-		std::atomic<bool> done{false};
-		context(int n) : results(n) {}
-	};
+		ctx->attach(*begin,
+			[i](auto& results, auto&& f) {
+				results[i] = std::move(f);
+			}
+		);
+	}
+	ctx->cancel();
+	ctx->release();
+	return fut;
+}
+
+
+// A few more chunks than the executor has threads, to even out uneven
+// chunks.
+inline size_t chunk_count(const executor& exec, size_t n) noexcept
+{
+	return std::min(n, exec.concurrency() * 4);
+}
+
+// Splits the `n` elements from `first` into chunk_count() chunks and runs
+// func(chunk_first, chunk_last, offset) for each of them on `exec`.
+template <typename Iterator, typename Func>
+inline void for_each_chunk(executor& exec, Iterator first, size_t n, Func func)
+{
+	auto chunks = chunk_count(exec, n);
+	size_t offset = 0;
+	for (size_t i = 0; i < chunks; ++i)
+	{
+		auto len = n / chunks + (i < n % chunks ? 1 : 0);
+		auto last = std::next(first, len);
+		exec.add(make_task(
+			[func, first, last, offset]() mutable {
+				func(first, last, offset);
+			}
+		));
+		first = last;
+		offset += len;
+	}
+}
+
+// Countdown shared by the chunks of a parallel algorithm. The chunk that
+// finishes last resolves the promise and deletes the context; the first
+// exception wins. The algorithms derive their own contexts from it, hence
+// the virtual destructor.
+template <typename... T>
+struct parallel_context : public pooled
+{
+	promise<T...> pr;
+	std::atomic<size_t> remaining;
+	std::atomic<bool> failed{false};
+	std::exception_ptr ex;
+
+	explicit parallel_context(size_t chunks)
+		: remaining(chunks)
+	{}
+
+	virtual ~parallel_context() {}
 
-	auto ctx = std::make_shared<context>(std::distance(begin, end));
+	void fail(std::exception_ptr e) noexcept
+	{
+		if (!failed.exchange(true))
+			ex = std::move(e);
+	}
 
-	size_t i = 0;
-	for (auto f = begin; f != end; ++f, ++i)
+	template <typename Result>
+	void chunk_done(Result&& result) noexcept
 	{
-		f->then(
-			[i, ctx](auto fut) {
-				if (!ctx->done.exchange(true))
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+		if (failed.load())
+			pr.set_exception(std::move(ex));
+		else
+			result();
+		delete this;
+	}
+};
+
+// The parallel algorithms run synchronous functions over a range on an
+// executor and resolve one future when every chunk is done. The range
+// has to outlive that future.
+
+// Calls func(x) for every element.
+template <typename Iterator, typename Func>
+inline future<> parallel_for_each(executor& exec, Iterator first, Iterator last, Func func)
+{
+	size_t n = std::distance(first, last);
+	if (n == 0)
+		return make_ready_future<>();
+
+	auto ctx = new parallel_context<>(chunk_count(exec, n));
+	auto fut = ctx->pr.get_future();
+	for_each_chunk(exec, first, n,
+		[ctx, func](Iterator b, Iterator e, size_t) mutable {
+			try
+			{
+				for (; b != e; ++b)
 				{
-					ctx->results[i] = std::move(fut);
-					ctx->pro.set_value(std::move(ctx->results));
+					func(*b);
 				}
 			}
-		);
+			catch (...)
+			{
+				ctx->fail(std::current_exception());
+			}
+			ctx->chunk_done([ctx] { ctx->pr.set_value(); });
+		}
+	);
+	return fut;
+}
+
+template <typename Range, typename Func>
+inline future<> parallel_for_each(executor& exec, Range& range, Func func)
+{
+	return parallel_for_each(exec, std::begin(range), std::end(range), std::move(func));
+}
+
+// Collects func(x) of every element, in order. The mapped type has to be
+// default constructible.
+template <typename Iterator, typename Func,
+		  typename R = std::decay_t<std::result_of_t<Func(typename std::iterator_traits<Iterator>::reference)> > >
+inline future<std::vector<R> > map(executor& exec, Iterator first, Iterator last, Func func)
+{
+	struct context : parallel_context<std::vector<R> >
+	{
+		std::vector<R> results;
+		context(size_t chunks, size_t n)
+			: parallel_context<std::vector<R> >(chunks),
+			  results(n)
+		{}
+	};
+
+	size_t n = std::distance(first, last);
+	if (n == 0)
+		return make_ready_future<std::vector<R> >({});
+
+	auto ctx = new context(chunk_count(exec, n), n);
+	auto fut = ctx->pr.get_future();
+	for_each_chunk(exec, first, n,
+		[ctx, func](Iterator b, Iterator e, size_t offset) mutable {
+			try
+			{
+				for (auto out = ctx->results.begin() + offset; b != e; ++b, ++out)
+				{
+					*out = func(*b);
+				}
+			}
+			catch (...)
+			{
+				ctx->fail(std::current_exception());
+			}
+			ctx->chunk_done([ctx] { ctx->pr.set_value(std::move(ctx->results)); });
+		}
+	);
+	return fut;
+}
+
+template <typename Range, typename Func>
+inline auto map(executor& exec, Range& range, Func func)
+{
+	return map(exec, std::begin(range), std::end(range), std::move(func));
+}
+
+// Folds a chunk of map_reduce() into the total. A mapper that yields R
+// itself lets the chunk fold its values as they come, from the first one
+// on, and take the lock once to fold its result in.
+template <typename Context, typename Iterator, typename Mapper>
+inline void reduce_chunk(Context& ctx, Iterator b, Iterator e, Mapper& mapper, std::true_type)
+{
+	auto acc = mapper(*b);
+	for (++b; b != e; ++b)
+	{
+		acc = ctx.reducer(std::move(acc), mapper(*b));
+	}
+	std::lock_guard<spinlock> lock(ctx.lock);
+	ctx.acc = ctx.reducer(std::move(ctx.acc), std::move(acc));
+}
+
+// Otherwise there is nothing to start a fold of the chunk's own from: the
+// mapped values are kept and folded in under the lock once the chunk is done.
+template <typename Context, typename Iterator, typename Mapper>
+inline void reduce_chunk(Context& ctx, Iterator b, Iterator e, Mapper& mapper, std::false_type)
+{
+	std::vector<std::decay_t<decltype(mapper(*b))> > mapped;
+	mapped.reserve(std::distance(b, e));
+	for (; b != e; ++b)
+	{
+		mapped.push_back(mapper(*b));
+	}
+
+	std::lock_guard<spinlock> lock(ctx.lock);
+	for (auto& m : mapped)
+	{
+		ctx.acc = ctx.reducer(std::move(ctx.acc), std::move(m));
 	}
-	return ctx->pro.get_future();
 }
 
+// Folds reducer(acc, mapper(x)) over every element, starting from `init`.
+// Each chunk maps its elements on its own and folds them into the
+// accumulator as soon as it is done, so the reduction overlaps with the
+// chunks still running; the reducer has to be associative and commutative.
+template <typename Iterator, typename Mapper, typename R, typename Reducer>
+inline future<R> map_reduce(executor& exec, Iterator first, Iterator last,
+							Mapper mapper, R init, Reducer reducer)
+{
+	using mapped_type = std::decay_t<std::result_of_t<Mapper(typename std::iterator_traits<Iterator>::reference)> >;
+
+	struct context : parallel_context<R>
+	{
+		spinlock lock;
+		R acc;
+		Reducer reducer;
+		context(size_t chunks, R&& init, Reducer&& r)
+			: parallel_context<R>(chunks),
+			  acc(std::move(init)),
+			  reducer(std::move(r))
+		{}
+	};
+
+	size_t n = std::distance(first, last);
+	if (n == 0)
+		return make_ready_future<R>(std::move(init));
+
+	auto ctx = new context(chunk_count(exec, n), std::move(init), std::move(reducer));
+	auto fut = ctx->pr.get_future();
+	for_each_chunk(exec, first, n,
+		[ctx, mapper](Iterator b, Iterator e, size_t) mutable {
+			try
+			{
+				reduce_chunk(*ctx, b, e, mapper, std::is_same<mapped_type, R>());
+			}
+			catch (...)
+			{
+				ctx->fail(std::current_exception());
+			}
+			ctx->chunk_done([ctx] { ctx->pr.set_value(std::move(ctx->acc)); });
+		}
+	);
+	return fut;
+}
 
-// TODO:
-// for_each
-// map
-// reduce
+template <typename Range, typename Mapper, typename R, typename Reducer>
+inline future<R> map_reduce(executor& exec, Range& range, Mapper mapper, R init, Reducer reducer)
+{
+	return map_reduce(exec, std::begin(range), std::end(range),
+					  std::move(mapper), std::move(init), std::move(reducer));
+}
 
 } // namespace dot
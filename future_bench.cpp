@@ -0,0 +1,327 @@
+#include "future.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <new>
+#include <condition_variable>
+#include <mutex>
+
+
+static std::atomic<size_t> allocations{0};
+
+void* operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto p = std::malloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+// Through operator new, or from the slabs of the calling thread.
+static size_t allocated()
+{
+	return allocations.load() + dot::slab_allocator::local_stats().allocations;
+}
+
+
+struct allocation_counter
+{
+	benchmark::State& state;
+	size_t start{allocated()};
+
+	allocation_counter(benchmark::State& s) : state(s) {}
+	~allocation_counter()
+	{
+		state.counters["allocs"] = benchmark::Counter(
+			allocated() - start,
+			benchmark::Counter::kAvgIterations
+		);
+	}
+};
+
+
+static void set_then_get(benchmark::State& state)
+{
+	allocation_counter counter(state);
+	for (auto _ : state)
+	{
+		dot::promise<int> pr;
+		auto fut = pr.get_future();
+		pr.set_value(13);
+		benchmark::DoNotOptimize(fut.get());
+	}
+}
+BENCHMARK(set_then_get);
+
+static void ready_then_chain(benchmark::State& state)
+{
+	allocation_counter counter(state);
+	for (auto _ : state)
+	{
+		auto fut = dot::make_ready_future<int>(0);
+		for (int i = 0; i < state.range(0); i++)
+		{
+			fut = fut.then([](dot::future<int> f) { return f.get() + 1; });
+		}
+		benchmark::DoNotOptimize(fut.get());
+	}
+}
+BENCHMARK(ready_then_chain)->Arg(1)->Arg(10)->Arg(100);
+
+// Same chain with noexcept continuations, which futurize calls without a
+// try block. `make codesize` compares the code generated for both.
+static void ready_then_chain_noexcept(benchmark::State& state)
+{
+	allocation_counter counter(state);
+	for (auto _ : state)
+	{
+		auto fut = dot::make_ready_future<int>(0);
+		for (int i = 0; i < state.range(0); i++)
+		{
+			fut = fut.then([](dot::future<int> f) noexcept { return f.get() + 1; });
+		}
+		benchmark::DoNotOptimize(fut.get());
+	}
+}
+BENCHMARK(ready_then_chain_noexcept)->Arg(1)->Arg(10)->Arg(100);
+
+static void pending_then_chain(benchmark::State& state)
+{
+	allocation_counter counter(state);
+	for (auto _ : state)
+	{
+		dot::promise<int> pr;
+		auto fut = pr.get_future();
+		for (int i = 0; i < state.range(0); i++)
+		{
+			fut = fut.then([](dot::future<int> f) { return f.get() + 1; });
+		}
+		pr.set_value(0);
+		benchmark::DoNotOptimize(fut.get());
+	}
+}
+BENCHMARK(pending_then_chain)->Arg(1)->Arg(10);
+
+// A failure passed down a chain of Arg continuations that each check for
+// it and pass it on, as an exception or as an error code.
+static void failed_then_chain_exception(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		auto fut = dot::make_exception_future<int>(std::runtime_error("shed"));
+		for (int i = 0; i < state.range(0); i++)
+		{
+			fut = fut.then([](dot::future<int> f) { return f.get() + 1; });
+		}
+		benchmark::DoNotOptimize(fut.failed());
+	}
+}
+BENCHMARK(failed_then_chain_exception)->Arg(1)->Arg(10);
+
+static void failed_then_chain_error(benchmark::State& state)
+{
+	auto ec = std::make_error_code(std::errc::connection_refused);
+	for (auto _ : state)
+	{
+		auto fut = dot::make_error_future<int>(ec);
+		for (int i = 0; i < state.range(0); i++)
+		{
+			fut = fut.then(
+				[](dot::future<int> f) {
+					if (f.failed())
+						return dot::make_error_future<int>(f.error());
+					return dot::make_ready_future(f.get() + 1);
+				}
+			);
+		}
+		benchmark::DoNotOptimize(fut.failed());
+	}
+}
+BENCHMARK(failed_then_chain_error)->Arg(1)->Arg(10);
+
+// Arg: number of pending inputs joined by one when_all().
+static void when_all_fan_out(benchmark::State& state)
+{
+	std::vector<dot::promise<int> > promises(state.range(0));
+	std::vector<dot::future<int> > futures(state.range(0));
+	allocation_counter counter(state);
+	for (auto _ : state)
+	{
+		// only the allocations of when_all() itself are counted
+		state.PauseTiming();
+		auto setup = allocated();
+		for (size_t i = 0; i < promises.size(); ++i)
+		{
+			promises[i] = dot::promise<int>();
+			futures[i] = promises[i].get_future();
+		}
+		counter.start += allocated() - setup;
+		state.ResumeTiming();
+
+		auto all = dot::when_all(begin(futures), end(futures));
+		for (auto& p : promises)
+		{
+			p.set_value(1);
+		}
+		benchmark::DoNotOptimize(all.get());
+	}
+}
+BENCHMARK(when_all_fan_out)->Arg(2)->Arg(64)->Arg(4096)->Arg(1 << 20);
+
+// Arg: number of continuations on one shared_future, each reading the
+// same 1 KiB value by reference.
+static void shared_fan_out(benchmark::State& state)
+{
+	allocation_counter counter(state);
+	for (auto _ : state)
+	{
+		dot::promise<std::vector<char> > pr;
+		auto shared = pr.get_future().share();
+		size_t total = 0;
+		for (int i = 0; i < state.range(0); ++i)
+		{
+			shared.then(
+				[&total](const dot::shared_future<std::vector<char> >& f) {
+					total += f.get().size();
+				}
+			);
+		}
+		pr.set_value(std::vector<char>(1024));
+		benchmark::DoNotOptimize(total);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(shared_fan_out)->Arg(1)->Arg(64)->Arg(4096);
+
+// Arg: spin budget of the waiting thread.
+static void cross_thread_get(benchmark::State& state)
+{
+	auto saved = dot::local_wait_policy();
+	dot::local_wait_policy().spins = state.range(0);
+	auto stats = dot::local_wait_stats();
+	std::atomic<dot::promise<int>*> slot{nullptr};
+	std::atomic<size_t> completed{0};
+	std::atomic<bool> done{false};
+	std::thread producer(
+		[&] {
+			while (!done.load(std::memory_order_relaxed))
+			{
+				if (auto pr = slot.exchange(nullptr))
+				{
+					pr->set_value(13);
+					completed.fetch_add(1);
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+	);
+	size_t issued = 0;
+	for (auto _ : state)
+	{
+		dot::promise<int> pr;
+		auto fut = pr.get_future();
+		slot.store(&pr);
+		benchmark::DoNotOptimize(fut.get());
+		++issued;
+		while (completed.load() != issued)
+			std::this_thread::yield();
+	}
+	done = true;
+	producer.join();
+
+	auto& after = dot::local_wait_stats();
+	state.counters["spun"] = benchmark::Counter(after.spun - stats.spun, benchmark::Counter::kAvgIterations);
+	state.counters["yielded"] = benchmark::Counter(after.yielded - stats.yielded, benchmark::Counter::kAvgIterations);
+	state.counters["parked"] = benchmark::Counter(after.parked - stats.parked, benchmark::Counter::kAvgIterations);
+	dot::local_wait_policy() = saved;
+}
+BENCHMARK(cross_thread_get)->Arg(0)->Arg(1000)->Arg(10000)->UseRealTime();
+
+// The allocations behind a pending then(): state, result state and freeing
+// both again, all on one thread.
+template <typename Alloc>
+static void alloc_free_local(benchmark::State& state)
+{
+	std::vector<void*> blocks(state.range(0));
+	for (auto _ : state)
+	{
+		for (auto& p : blocks)
+		{
+			p = Alloc::allocate(192);
+		}
+		for (auto p : blocks)
+		{
+			Alloc::deallocate(p, 192);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(alloc_free_local, dot::slab_allocator)->Arg(1)->Arg(1000);
+BENCHMARK_TEMPLATE(alloc_free_local, dot::heap_allocator)->Arg(1)->Arg(1000);
+
+// Allocated here, freed by another thread, as when a setter runs the
+// continuation. Arg: blocks handed over at a time.
+template <typename Alloc>
+static void alloc_free_remote(benchmark::State& state)
+{
+	std::mutex lock;
+	std::condition_variable cond;
+	std::vector<void*> handed;
+	bool done = false;
+	std::thread freer(
+		[&] {
+			std::vector<void*> blocks;
+			std::unique_lock<std::mutex> l(lock);
+			while (!done || !handed.empty())
+			{
+				if (handed.empty())
+				{
+					cond.wait(l);
+					continue;
+				}
+				blocks.swap(handed);
+				l.unlock();
+				cond.notify_all();
+				for (auto p : blocks)
+				{
+					Alloc::deallocate(p, 192);
+				}
+				blocks.clear();
+				l.lock();
+			}
+		}
+	);
+	std::vector<void*> blocks;
+	for (auto _ : state)
+	{
+		for (int i = 0; i < state.range(0); ++i)
+		{
+			blocks.push_back(Alloc::allocate(192));
+		}
+		std::unique_lock<std::mutex> l(lock);
+		cond.wait(l, [&] { return handed.empty(); });
+		handed.swap(blocks);
+		cond.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> l(lock);
+		done = true;
+	}
+	cond.notify_all();
+	freer.join();
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(alloc_free_remote, dot::slab_allocator)->Arg(1000)->UseRealTime();
+BENCHMARK_TEMPLATE(alloc_free_remote, dot::heap_allocator)->Arg(1000)->UseRealTime();
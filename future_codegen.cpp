@@ -0,0 +1,23 @@
+#include "future.hpp"
+
+// Not a test: `make codesize` prints the size of the code generated for
+// these two chains of eight ready continuations, which differ only in
+// whether the continuations are noexcept.
+
+int ready_chain_throwing(int x)
+{
+	auto add = [](dot::future<int> f) { return f.get() + 1; };
+	return dot::make_ready_future<int>(std::move(x))
+		.then(add).then(add).then(add).then(add)
+		.then(add).then(add).then(add).then(add)
+		.get();
+}
+
+int ready_chain_noexcept(int x)
+{
+	auto add = [](dot::future<int> f) noexcept { return f.get() + 1; };
+	return dot::make_ready_future<int>(std::move(x))
+		.then(add).then(add).then(add).then(add)
+		.then(add).then(add).then(add).then(add)
+		.get();
+}
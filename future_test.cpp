@@ -1,7 +1,40 @@
 #include "future.hpp"
+#include "queue_executor.hpp"
 #include "gtest/gtest.h"
 #include <typeinfo>
 #include <cxxabi.h>
+#include <numeric>
+#include <array>
+#include <cstdlib>
+#include <new>
+
+
+static std::atomic<size_t> allocations{0};
+
+void* operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto p = std::malloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+
+// Through operator new, or from the slabs of the calling thread.
+static size_t allocated()
+{
+	return allocations.load() + dot::slab_allocator::local_stats().allocations;
+}
 
 
 std::string name(const std::type_info& info)
@@ -118,6 +151,60 @@ TEST(ReadyFutureTest, failed)
 	);
 }
 
+TEST(ReadyFutureTest, error_code)
+{
+	auto ec = std::make_error_code(std::errc::connection_refused);
+	auto fut = dot::make_error_future<int>(ec);
+	EXPECT_TRUE(fut.failed());
+	EXPECT_TRUE(fut.ready());
+	EXPECT_EQ(fut.error(), ec);
+
+	// passed on without a throw, until someone asks for the value
+	int calls = 0;
+	auto res = std::move(fut).then(
+		[&calls](dot::future<int> f) {
+			calls++;
+			if (f.failed())
+				return dot::make_error_future<bool>(f.error());
+			return dot::make_ready_future(true);
+		}
+	);
+	EXPECT_EQ(calls, 1);
+	EXPECT_EQ(res.error(), ec);
+	try
+	{
+		res.get();
+		FAIL();
+	}
+	catch (const std::system_error& e)
+	{
+		EXPECT_EQ(e.code(), ec);
+	}
+
+	auto ex = dot::make_exception_future<>(std::runtime_error("err"));
+	EXPECT_TRUE(ex.failed());
+	EXPECT_FALSE(ex.error());
+}
+
+TEST(ReadyFutureTest, then_noexcept)
+{
+	auto plain = [](dot::future<int> f) { return f.get() + 1; };
+	auto nothrow = [](dot::future<int> f) noexcept { return f.ready() ? 1 : 0; };
+	static_assert(!dot::futurize<int>::nothrow<decltype(plain), dot::future<int> >::value, "");
+	static_assert(dot::futurize<int>::nothrow<decltype(nothrow), dot::future<int> >::value, "");
+
+	auto res = dot::make_ready_future(1).then(nothrow).then(plain).then(plain);
+	EXPECT_EQ(res.get(), 3);
+
+	// a throwing continuation still ends up in the future
+	auto failed = dot::make_ready_future(1).then(nothrow).then(
+		[](dot::future<int> f) -> int {
+			throw std::runtime_error("err");
+		}
+	);
+	EXPECT_THROW(failed.get(), std::runtime_error);
+}
+
 TEST(ReadyFutureTest, when_all_empty)
 {
 	auto f = dot::when_all();
@@ -691,3 +778,662 @@ TEST_F(FutureTest, fake_accept)
 	sleep(10);
 	std::cout << std::this_thread::get_id() << " after accept" << std::endl;
 }
+
+TEST(PromiseTest, broken_promise)
+{
+	dot::future<int> fut;
+	{
+		dot::promise<int> pr;
+		fut = pr.get_future();
+	}
+	EXPECT_TRUE(fut.ready());
+	EXPECT_TRUE(fut.failed());
+	EXPECT_THROW(fut.get(), std::future_error);
+}
+
+TEST(PromiseTest, set_error)
+{
+	auto ec = std::make_error_code(std::errc::timed_out);
+	dot::promise<int> pr;
+	auto fut = pr.get_future();
+	EXPECT_FALSE(fut.error());
+	dot::promise<int> forwarded;
+	auto res = forwarded.get_future();
+	fut.forward_to(std::move(forwarded));
+
+	std::thread setter([&pr, ec] { pr.set_error(ec); });
+	setter.join();
+	EXPECT_TRUE(res.failed());
+	EXPECT_EQ(res.error(), ec);
+	EXPECT_THROW(res.get(), std::system_error);
+	EXPECT_THROW(pr.set_value(1), std::future_error);
+}
+
+TEST(PromiseTest, already_satisfied)
+{
+	dot::promise<int> pr;
+	auto fut = pr.get_future();
+	EXPECT_THROW(pr.get_future(), std::future_error);
+	pr.set_value(1);
+	EXPECT_THROW(pr.set_value(2), std::future_error);
+	EXPECT_EQ(fut.get(), 1);
+}
+
+TEST(PromiseTest, stress_set_then_get)
+{
+	constexpr int n = 20000;
+	std::vector<dot::promise<int> > promises(n);
+	std::vector<dot::future<int> > futures;
+	futures.reserve(n);
+	for (auto& p : promises)
+	{
+		futures.push_back(p.get_future());
+	}
+
+	std::atomic<long> sum{0};
+	std::thread setter(
+		[&promises] {
+			for (int i = 0; i < n; i++)
+			{
+				promises[i].set_value(i);
+			}
+		}
+	);
+	std::thread consumer(
+		[&futures, &sum] {
+			for (int i = 0; i < n; i++)
+			{
+				if (i % 2)
+				{
+					sum += futures[i].get();
+				}
+				else
+				{
+					futures[i].then(
+						[&sum](dot::future<int> fut) {
+							sum += fut.get();
+						}
+					);
+				}
+			}
+		}
+	);
+	setter.join();
+	consumer.join();
+	EXPECT_EQ(sum, long(n) * (n - 1) / 2);
+}
+
+TEST(PromiseTest, continuation_allocations)
+{
+	dot::promise<int> pr;
+	auto fut = pr.get_future();
+	int sum = 0;
+	int* p = &sum;
+
+	// the state of the returned future is the only allocation
+	auto before = allocated();
+	auto res = fut.then(
+		[p, &sum](dot::future<int> fut) {
+			*p += fut.get();
+		}
+	);
+	EXPECT_EQ(allocated() - before, 1);
+
+	before = allocated();
+	pr.set_value(13);
+	EXPECT_EQ(allocated() - before, 0);
+	EXPECT_EQ(sum, 13);
+	EXPECT_TRUE(res.ready());
+
+	// oversized captures fall back to the heap
+	dot::promise<int> big_pr;
+	auto big_fut = big_pr.get_future();
+	std::array<char, 256> big{};
+	before = allocated();
+	auto big_res = big_fut.then(
+		[big](dot::future<int> fut) {
+			return big[0] + fut.get();
+		}
+	);
+	EXPECT_EQ(allocated() - before, 2);
+	big_pr.set_value(1);
+	EXPECT_EQ(big_res.get(), 1);
+}
+
+TEST(PromiseTest, when_all_allocations)
+{
+	// context and result state, however many inputs there are
+	dot::promise<int> p1;
+	dot::promise<> p2;
+	auto f1 = p1.get_future();
+	auto f2 = p2.get_future();
+	auto before = allocated();
+	auto all = dot::when_all(std::move(f1), std::move(f2), dot::make_ready_future(3));
+	EXPECT_EQ(allocated() - before, 2);
+	p2.set_value();
+	EXPECT_FALSE(all.ready());
+	p1.set_value(1);
+	EXPECT_EQ(std::get<0>(all.get()).get(), 1);
+
+	// plus the result vector
+	std::vector<dot::promise<int> > promises(100);
+	std::vector<dot::future<int> > futures;
+	for (auto& p : promises)
+	{
+		futures.push_back(p.get_future());
+	}
+	before = allocated();
+	auto vec = dot::when_all(begin(futures), end(futures));
+	EXPECT_EQ(allocated() - before, 3);
+	before = allocated();
+	for (size_t i = 0; i < promises.size(); ++i)
+	{
+		EXPECT_FALSE(vec.ready());
+		promises[i].set_value(i);
+	}
+	EXPECT_EQ(allocated() - before, 0);
+	auto results = vec.get();
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		EXPECT_EQ(results[i].get(), int(i));
+	}
+}
+
+TEST(PromiseTest, when_any_cancels_losers)
+{
+	std::vector<dot::promise<int> > promises(3);
+	std::vector<dot::future<int> > futures;
+	for (auto& p : promises)
+	{
+		futures.push_back(p.get_future());
+	}
+	auto any = dot::when_any(begin(futures), end(futures));
+	EXPECT_FALSE(promises[0].abandoned());
+
+	promises[1].set_value(42);
+	EXPECT_TRUE(promises[0].abandoned());
+	EXPECT_TRUE(promises[2].abandoned());
+	promises[0].set_value(1);
+	auto vec = any.get();
+	EXPECT_FALSE(vec[0].valid());
+	EXPECT_EQ(vec[1].get(), 42);
+	EXPECT_FALSE(vec[2].valid());
+
+	// a ready input wins right away, later inputs are not even attached
+	dot::promise<> p1;
+	dot::promise<bool> p2;
+	auto f1 = p1.get_future();
+	auto f2 = p2.get_future();
+	auto first = dot::when_any(std::move(f1), dot::make_ready_future(13), std::move(f2));
+	EXPECT_TRUE(p1.abandoned());
+	EXPECT_TRUE(p2.abandoned());
+	EXPECT_EQ(std::get<1>(first.get()).get(), 13);
+}
+
+TEST(PromiseTest, stress_when_any)
+{
+	for (int i = 0; i < 2000; ++i)
+	{
+		std::array<dot::promise<int>, 3> promises;
+		auto f0 = promises[0].get_future();
+		auto f1 = promises[1].get_future();
+		auto f2 = promises[2].get_future();
+		std::thread setter(
+			[&promises, i] {
+				promises[i % 3].set_value(i);
+				promises[(i + 1) % 3].set_value(i + 1);
+			}
+		);
+		auto any = dot::when_any(std::move(f0), std::move(f1), std::move(f2));
+		setter.join();
+		auto results = any.get();
+		int ready = std::get<0>(results).valid() + std::get<1>(results).valid() +
+			std::get<2>(results).valid();
+		EXPECT_EQ(ready, 1);
+		EXPECT_TRUE(promises[(i + 2) % 3].abandoned());
+	}
+}
+
+TEST(ExecutorTest, then_pending)
+{
+	queue_executor exec;
+	exec.tasks_.reserve(1);
+	dot::promise<int> pr;
+	auto fut = pr.get_future();
+	std::thread::id where;
+
+	auto res = fut.then(exec,
+		[&where](dot::future<int> fut) {
+			where = std::this_thread::get_id();
+			return fut.get() + 1;
+		}
+	);
+
+	size_t hop_allocations = 0;
+	std::thread setter(
+		[&pr, &hop_allocations] {
+			auto before = allocated();
+			pr.set_value(13);
+			hop_allocations = allocated() - before;
+		}
+	);
+	setter.join();
+	EXPECT_EQ(hop_allocations, 0);
+	EXPECT_FALSE(res.ready());
+
+	EXPECT_EQ(exec.run_all(), 1);
+	EXPECT_EQ(where, std::this_thread::get_id());
+	EXPECT_EQ(res.get(), 14);
+}
+
+TEST(ExecutorTest, then_ready)
+{
+	queue_executor exec;
+	auto res = dot::make_ready_future<int>(1).then(exec,
+		[](dot::future<int> fut) {
+			return fut.get() + 1;
+		}
+	);
+	EXPECT_FALSE(res.ready());
+	EXPECT_EQ(exec.run_all(), 1);
+	EXPECT_EQ(res.get(), 2);
+}
+
+TEST(ExecutorTest, via)
+{
+	queue_executor exec;
+	dot::promise<> pr;
+	int counter = 0;
+
+	auto res = pr.get_future().via(exec).then(
+		[&counter](dot::future<> fut) {
+			counter++;
+		}
+	);
+	pr.set_value();
+	EXPECT_EQ(counter, 0);
+	EXPECT_EQ(exec.run_all(), 1);
+	EXPECT_EQ(counter, 1);
+
+	dot::make_ready_future<>().via(exec).then(
+		[&counter](dot::future<> fut) {
+			counter++;
+		}
+	);
+	EXPECT_EQ(counter, 1);
+	EXPECT_EQ(exec.run_all(), 1);
+	EXPECT_EQ(counter, 2);
+}
+
+TEST(ExecutorTest, inline_executor)
+{
+	dot::inline_executor exec;
+	auto res = dot::make_ready_future<int>(1).then(exec,
+		[](dot::future<int> fut) {
+			return fut.get() + 1;
+		}
+	);
+	EXPECT_EQ(res.get(), 2);
+}
+
+struct copy_counter
+{
+	static int copies;
+
+	int value{0};
+
+	copy_counter() = default;
+	explicit copy_counter(int v) : value(v) {}
+	copy_counter(const copy_counter& x) : value(x.value) { copies++; }
+	copy_counter(copy_counter&&) = default;
+	copy_counter& operator=(const copy_counter& x) { value = x.value; copies++; return *this; }
+	copy_counter& operator=(copy_counter&&) = default;
+};
+
+int copy_counter::copies = 0;
+
+TEST(SharedFutureTest, fan_out)
+{
+	dot::promise<copy_counter> pr;
+	auto shared = pr.get_future().share();
+	EXPECT_FALSE(shared.ready());
+
+	int sum = 0;
+	std::vector<dot::future<> > results;
+	for (int i = 0; i < 100; ++i)
+	{
+		results.push_back(shared.then(
+			[&sum](const dot::shared_future<copy_counter>& f) {
+				sum += f.get().value;
+			}
+		));
+	}
+	copy_counter::copies = 0;
+	pr.set_value(copy_counter(2));
+	EXPECT_EQ(sum, 200);
+	EXPECT_EQ(copy_counter::copies, 0);
+	for (auto& r : results)
+	{
+		EXPECT_TRUE(r.ready());
+	}
+
+	// one value for every reader
+	auto copy = shared;
+	EXPECT_EQ(&copy.get(), &shared.get());
+	EXPECT_EQ(shared.then([](auto f) { return f.get().value + 1; }).get(), 3);
+	EXPECT_EQ(shared.get_future().get().value, 2);
+}
+
+TEST(SharedFutureTest, failed)
+{
+	auto ec = std::make_error_code(std::errc::timed_out);
+	auto shared = dot::make_error_future<int>(ec).share();
+	EXPECT_TRUE(shared.failed());
+	EXPECT_EQ(shared.error(), ec);
+	EXPECT_THROW(shared.get(), std::system_error);
+	EXPECT_THROW(shared.get(), std::system_error);
+
+	dot::promise<> pr;
+	auto pending = pr.get_future().share();
+	auto res = pending.then(
+		[](const dot::shared_future<>& f) {
+			f.get();
+		}
+	);
+	pr.set_exception(std::runtime_error("err"));
+	EXPECT_THROW(pending.get(), std::runtime_error);
+	EXPECT_THROW(res.get(), std::runtime_error);
+
+	dot::shared_future<int> invalid;
+	EXPECT_FALSE(invalid.valid());
+	EXPECT_THROW(invalid.get(), std::future_error);
+}
+
+TEST(SharedFutureTest, executor)
+{
+	queue_executor exec;
+	dot::promise<int> pr;
+	auto shared = pr.get_future().share();
+	auto res = shared.then(exec, [](auto f) { return f.get() + 1; });
+	pr.set_value(1);
+	EXPECT_FALSE(res.ready());
+	EXPECT_EQ(exec.run_all(), 1);
+	EXPECT_EQ(res.get(), 2);
+}
+
+TEST(SharedFutureTest, stress)
+{
+	for (int round = 0; round < 200; ++round)
+	{
+		dot::promise<int> pr;
+		auto shared = pr.get_future().share();
+		std::atomic<int> sum{0};
+		std::vector<std::thread> readers;
+		for (int i = 0; i < 4; ++i)
+		{
+			readers.emplace_back(
+				[shared, &sum] {
+					for (int j = 0; j < 10; ++j)
+					{
+						shared.then([&sum](const dot::shared_future<int>& f) { sum += f.get(); });
+					}
+					sum += shared.get();
+				}
+			);
+		}
+		pr.set_value(1);
+		for (auto& t : readers)
+		{
+			t.join();
+		}
+		EXPECT_EQ(sum.load(), 44);
+	}
+}
+
+struct batch_counting_executor : public queue_executor
+{
+	size_t batches{0};
+
+	virtual void add_batch(dot::task** tasks, size_t n) noexcept override
+	{
+		batches++;
+		queue_executor::add_batch(tasks, n);
+	}
+};
+
+TEST(PromiseBatchTest, continuations)
+{
+	batch_counting_executor exec;
+	std::vector<dot::promise<int> > promises(500);
+	std::vector<dot::future<int> > results;
+	int inline_runs = 0;
+	for (size_t i = 0; i < promises.size(); ++i)
+	{
+		if (i % 2)
+			results.push_back(promises[i].get_future().then(exec, [](dot::future<int> f) { return f.get(); }));
+		else
+			results.push_back(promises[i].get_future().then(
+				[&inline_runs](dot::future<int> f) {
+					inline_runs++;
+					return f.get();
+				}
+			));
+	}
+
+	{
+		dot::promise_batch batch;
+		for (size_t i = 0; i < promises.size(); ++i)
+		{
+			batch.set_value(promises[i], int(i));
+		}
+		// published, but nothing runs before the commit
+		EXPECT_EQ(inline_runs, 0);
+		EXPECT_THROW(batch.set_value(promises[0], 0), std::future_error);
+	}
+	EXPECT_EQ(inline_runs, 250);
+	EXPECT_EQ(exec.batches, 1);
+	EXPECT_EQ(exec.run_all(), 250);
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		EXPECT_EQ(results[i].get(), int(i));
+	}
+}
+
+TEST(PromiseBatchTest, failures)
+{
+	dot::promise<> a;
+	dot::promise<int> b;
+	dot::promise<int> c;
+	auto fa = a.get_future();
+	auto fb = b.get_future();
+	auto fc = c.get_future().then([](dot::future<int> f) { return f; });
+	auto ec = std::make_error_code(std::errc::timed_out);
+
+	dot::promise_batch batch;
+	batch.set_value(a);
+	batch.set_exception(b, std::make_exception_ptr(std::runtime_error("err")));
+	batch.set_error(c, ec);
+	batch.commit();
+	fa.get();
+	EXPECT_THROW(fb.get(), std::runtime_error);
+	EXPECT_EQ(fc.error(), ec);
+}
+
+TEST(PromiseBatchTest, one_wakeup)
+{
+	std::vector<dot::promise<int> > promises(100);
+	std::vector<dot::future<int> > futures;
+	for (auto& pr : promises)
+	{
+		futures.push_back(pr.get_future());
+	}
+
+	uint64_t parked = 0;
+	std::thread waiter(
+		[&futures, &parked] {
+			dot::local_wait_policy() = dot::wait_policy{0, 0};
+			auto before = dot::local_wait_stats().parked;
+			for (size_t i = 0; i < futures.size(); ++i)
+			{
+				EXPECT_EQ(futures[i].get(), int(i));
+			}
+			parked = dot::local_wait_stats().parked - before;
+		}
+	);
+	usleep(1000);
+	{
+		dot::promise_batch batch;
+		for (size_t i = 0; i < promises.size(); ++i)
+		{
+			batch.set_value(promises[i], int(i));
+		}
+		usleep(1000);
+	}
+	waiter.join();
+	EXPECT_LE(parked, 1);
+}
+
+TEST(PromiseTest, wait_policy)
+{
+	auto saved = dot::local_wait_policy();
+	auto& stats = dot::local_wait_stats();
+
+	// ready futures never reach the wait phases
+	{
+		auto before = stats;
+		dot::promise<int> pr;
+		auto fut = pr.get_future();
+		pr.set_value(1);
+		EXPECT_EQ(fut.get(), 1);
+		EXPECT_EQ(stats.spun + stats.yielded + stats.parked,
+				  before.spun + before.yielded + before.parked);
+	}
+
+	// no budget: straight to the futex
+	{
+		dot::local_wait_policy() = dot::wait_policy{0, 0};
+		auto before = stats.parked;
+		dot::promise<int> pr;
+		auto fut = pr.get_future();
+		std::thread setter(
+			[&pr] {
+				usleep(1000);
+				pr.set_value(2);
+			}
+		);
+		EXPECT_EQ(fut.get(), 2);
+		EXPECT_EQ(stats.parked, before + 1);
+		setter.join();
+	}
+
+	// timed waits honour the deadline during the spin phases
+	{
+		dot::local_wait_policy() = dot::wait_policy{1u << 30, 1u << 30};
+		dot::promise<int> pr;
+		auto fut = pr.get_future();
+		using namespace std::literals::chrono_literals;
+		EXPECT_EQ(fut.wait_for(1ms), dot::future_status::timeout);
+	}
+
+	dot::local_wait_policy() = saved;
+}
+
+TEST(ParallelTest, for_each)
+{
+	dot::inline_executor exec;
+	std::vector<int> v(100);
+	std::iota(v.begin(), v.end(), 1);
+
+	std::atomic<int> sum{0};
+	auto fut = dot::parallel_for_each(exec, v,
+		[&sum](int x) {
+			sum += x;
+		}
+	);
+	fut.get();
+	EXPECT_EQ(sum, 5050);
+
+	std::vector<int> empty;
+	dot::parallel_for_each(exec, empty, [](int) {}).get();
+}
+
+TEST(ParallelTest, map)
+{
+	dot::inline_executor exec;
+	std::vector<int> v{1, 2, 3, 4, 5, 6, 7};
+	auto squares = dot::map(exec, v.begin(), v.end(),
+		[](int x) {
+			return std::to_string(x * x);
+		}
+	).get();
+	EXPECT_EQ(squares, std::vector<std::string>({"1", "4", "9", "16", "25", "36", "49"}));
+}
+
+TEST(ParallelTest, map_reduce)
+{
+	dot::inline_executor exec;
+	std::vector<int> v(1000);
+	std::iota(v.begin(), v.end(), 0);
+	auto fut = dot::map_reduce(exec, v,
+		[](int x) {
+			return long(x) * x;
+		},
+		0L,
+		[](long acc, long x) {
+			return acc + x;
+		}
+	);
+	EXPECT_EQ(fut.get(), 332833500L);
+
+	// mapped to another type than the accumulator's
+	auto lengths = dot::map_reduce(exec, v,
+		[](int x) {
+			return std::to_string(x);
+		},
+		size_t(0),
+		[](size_t acc, const std::string& s) {
+			return acc + s.size();
+		}
+	);
+	EXPECT_EQ(lengths.get(), 2890);
+
+	std::vector<int> empty;
+	EXPECT_EQ(dot::map_reduce(exec, empty, [](int x) { return x; }, 42, std::plus<int>()).get(), 42);
+}
+
+TEST(ParallelTest, allocations)
+{
+	// contexts, states and chunk tasks all come from the slabs
+	dot::inline_executor exec;
+	std::vector<int> v(100);
+	auto heap = allocations.load();
+	auto slabs = dot::slab_allocator::local_stats().allocations;
+	dot::parallel_for_each(exec, v, [](int) {}).get();
+	EXPECT_EQ(allocations.load() - heap, 0);
+	EXPECT_GT(dot::slab_allocator::local_stats().allocations - slabs, 0);
+
+	// but for the result vector
+	heap = allocations.load();
+	dot::map(exec, v, [](int x) { return x; }).get();
+	EXPECT_EQ(allocations.load() - heap, 1);
+
+	// chunks fold into an accumulator of their own
+	heap = allocations.load();
+	dot::map_reduce(exec, v, [](int x) { return x; }, 0, std::plus<int>()).get();
+	EXPECT_EQ(allocations.load() - heap, 0);
+}
+
+TEST(ParallelTest, exception)
+{
+	dot::inline_executor exec;
+	std::vector<int> v(100);
+	auto fut = dot::map_reduce(exec, v,
+		[](int x) {
+			throw std::runtime_error("error");
+			return x;
+		},
+		0,
+		std::plus<int>()
+	);
+	EXPECT_THROW(fut.get(), std::runtime_error);
+}
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#pragma once
+
+namespace dot
+{
+
+// A growable ring of trivially copyable values whose storage is mapped
+// twice, back to back: the pages of a memfd are mapped at `base` and again
+// at `base + capacity`, so the value past the last slot is the first slot
+// itself. Whatever the live range, data() points at it as one contiguous
+// run, and so does writable() at the room after it; indices are masked when
+// they advance rather than on every access. A parser can read framed
+// records straight out of the ring without looking for the wrap.
+//
+// The capacity is a power-of-two number of pages. Growing maps a new,
+// larger pair and copies the live values over.
+template <typename T>
+class mirrored_ring
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+				  "values are copied as bytes");
+	static_assert((sizeof(T) & (sizeof(T) - 1)) == 0,
+				  "value size must divide the page size");
+
+private:
+	T* storage_{nullptr};
+	size_t begin_{0};
+	size_t size_{0};
+	size_t capacity_{0};
+
+public:
+	// Room for at least `capacity` values, if any.
+	explicit mirrored_ring(size_t capacity = 0)
+	{
+		if (capacity)
+			expand(capacity);
+	}
+
+	mirrored_ring(const mirrored_ring&) = delete;
+	mirrored_ring(mirrored_ring&& x) noexcept
+		: storage_(std::exchange(x.storage_, nullptr)),
+		  begin_(std::exchange(x.begin_, 0)),
+		  size_(std::exchange(x.size_, 0)),
+		  capacity_(std::exchange(x.capacity_, 0))
+	{}
+	mirrored_ring& operator=(const mirrored_ring&) = delete;
+	mirrored_ring& operator=(mirrored_ring&&) = delete;
+
+	~mirrored_ring()
+	{
+		unmap(storage_, capacity_);
+	}
+
+	bool empty() const
+	{
+		return size_ == 0;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	size_t capacity() const
+	{
+		return capacity_;
+	}
+
+	// The live values, oldest first, as one run of size() values.
+	T* data()
+	{
+		return storage_ + begin_;
+	}
+
+	const T* data() const
+	{
+		return storage_ + begin_;
+	}
+
+	T& operator[](size_t idx)
+	{
+		return data()[idx];
+	}
+
+	T& front()
+	{
+		return data()[0];
+	}
+
+	T& back()
+	{
+		return data()[size_ - 1];
+	}
+
+	// All the room past the last value, at least `n`, growing the ring if
+	// need be; capacity() - size() values from the returned pointer on. What
+	// was written becomes live with commit().
+	T* writable(size_t n)
+	{
+		if (size_ + n > capacity_)
+			expand(size_ + n);
+		return data() + size_;
+	}
+
+	// Appends the first `n` values written to writable().
+	void commit(size_t n)
+	{
+		size_ += n;
+	}
+
+	void push_back(const T& value)
+	{
+		*writable(1) = value;
+		++size_;
+	}
+
+	void append_from(const T* from, size_t n)
+	{
+		if (n == 0)
+			return;
+		std::memcpy(writable(n), from, n * sizeof(T));
+		size_ += n;
+	}
+
+	// Copies up to `n` values from the front to out[0, n) and drops them;
+	// returns how many there were.
+	size_t consume_into(T* out, size_t n)
+	{
+		n = std::min(n, size_);
+		if (n == 0)
+			return 0;
+		std::memcpy(out, data(), n * sizeof(T));
+		pop_front(n);
+		return n;
+	}
+
+	void pop_front()
+	{
+		pop_front(1);
+	}
+
+	void pop_front(size_t n)
+	{
+		begin_ = (begin_ + n) & (capacity_ - 1);
+		size_ -= n;
+	}
+
+	void pop_back()
+	{
+		--size_;
+	}
+
+private:
+	// Maps the smallest power-of-two number of pages holding `min_capacity`
+	// values, at least double the current capacity, and moves the live
+	// values to its start.
+	void expand(size_t min_capacity)
+	{
+		size_t bytes = ::sysconf(_SC_PAGESIZE);
+		while (bytes < capacity_ * 2 * sizeof(T) || bytes < min_capacity * sizeof(T))
+		{
+			bytes *= 2;
+		}
+		auto storage = static_cast<T*>(map(bytes));
+		if (size_)
+			std::memcpy(storage, data(), size_ * sizeof(T));
+		unmap(storage_, capacity_);
+		storage_ = storage;
+		capacity_ = bytes / sizeof(T);
+		begin_ = 0;
+	}
+
+	static void* map(size_t bytes)
+	{
+		int fd = ::memfd_create("dot::mirrored_ring", MFD_CLOEXEC);
+		if (fd < 0)
+			throw std::system_error(errno, std::system_category(), "memfd_create");
+		// reserve both halves first, so that nothing else lands in between
+		auto base = static_cast<char*>(::mmap(nullptr, 2 * bytes, PROT_NONE,
+											  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (::ftruncate(fd, bytes) < 0 || base == MAP_FAILED ||
+			::mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+			::mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+		{
+			auto err = errno;
+			if (base != MAP_FAILED)
+				::munmap(base, 2 * bytes);
+			::close(fd);
+			throw std::system_error(err, std::system_category(), "mmap");
+		}
+		// the mappings keep the memory alive
+		::close(fd);
+		return base;
+	}
+
+	static void unmap(T* storage, size_t capacity) noexcept
+	{
+		if (storage)
+			::munmap(storage, 2 * capacity * sizeof(T));
+	}
+};
+
+} // namespace dot
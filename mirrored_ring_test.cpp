@@ -0,0 +1,91 @@
+#include "gtest/gtest.h"
+#include "mirrored_ring.hpp"
+#include <cstdint>
+#include <string>
+
+using namespace dot;
+
+TEST(MirroredRingTest, contiguous)
+{
+	mirrored_ring<char> ring(100);
+	auto cap = ring.capacity();
+	EXPECT_EQ(cap % ::sysconf(_SC_PAGESIZE), 0);
+
+	// move the live range up to the end of the storage
+	std::string filler(cap - 3, 'x');
+	ring.append_from(filler.data(), filler.size());
+	ring.pop_front(filler.size());
+
+	// straddles the end, yet reads as one run
+	ring.append_from("abcdef", 6);
+	EXPECT_EQ(ring.capacity(), cap);
+	EXPECT_EQ(std::string(ring.data(), ring.size()), "abcdef");
+	EXPECT_EQ(ring[4], 'e');
+
+	// and so does the room after it
+	auto w = ring.writable(3);
+	std::memcpy(w, "ghi", 3);
+	ring.commit(3);
+	char out[16];
+	EXPECT_EQ(ring.consume_into(out, 16), 9);
+	EXPECT_EQ(std::string(out, 9), "abcdefghi");
+	EXPECT_TRUE(ring.empty());
+}
+
+TEST(MirroredRingTest, grow)
+{
+	mirrored_ring<uint32_t> ring;
+	EXPECT_EQ(ring.capacity(), 0);
+	ring.push_back(1);
+	auto cap = ring.capacity();
+	for (uint32_t i = 2; i <= cap; ++i)
+	{
+		ring.push_back(i);
+	}
+	ring.pop_front(cap / 2);
+
+	// wrapped, then moved whole into a bigger mapping
+	for (uint32_t i = cap + 1; i <= 2 * cap; ++i)
+	{
+		ring.push_back(i);
+	}
+	EXPECT_EQ(ring.capacity(), 2 * cap);
+	ASSERT_EQ(ring.size(), cap + cap / 2);
+	for (size_t i = 0; i < ring.size(); ++i)
+	{
+		ASSERT_EQ(ring[i], cap / 2 + 1 + i);
+	}
+	EXPECT_EQ(ring.back(), 2 * cap);
+
+	auto moved = std::move(ring);
+	EXPECT_EQ(moved.front(), cap / 2 + 1);
+	EXPECT_EQ(ring.capacity(), 0);
+}
+
+TEST(MirroredRingTest, records)
+{
+	// length-prefixed records read in place, across the wrap
+	mirrored_ring<char> ring(1);
+	std::string payload;
+	size_t parsed = 0;
+	for (int i = 0; i < 1000; ++i)
+	{
+		payload.assign(i % 50, char('a' + i % 26));
+		uint32_t len = payload.size();
+		ring.append_from(reinterpret_cast<const char*>(&len), sizeof(len));
+		ring.append_from(payload.data(), payload.size());
+
+		while (ring.size() >= sizeof(uint32_t))
+		{
+			uint32_t n;
+			std::memcpy(&n, ring.data(), sizeof(n));
+			if (ring.size() < sizeof(n) + n)
+				break;
+			EXPECT_EQ(std::string(ring.data() + sizeof(n), n), payload);
+			ring.pop_front(sizeof(n) + n);
+			++parsed;
+		}
+	}
+	EXPECT_EQ(parsed, 1000);
+	EXPECT_EQ(ring.capacity(), size_t(::sysconf(_SC_PAGESIZE)));
+}
@@ -0,0 +1,391 @@
+#include "future.hpp"
+#include "circular_buffer.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#pragma once
+
+namespace dot
+{
+
+// A fixed-size ring for any number of producer and consumer threads, after
+// Vyukov's bounded MPMC queue. Each slot carries a sequence number telling
+// whose turn it is: a producer may fill the slot of turn `pos` once its
+// sequence is `pos`, a consumer may empty it once it is `pos + 1`, and
+// emptying hands the slot to the producer one lap later. Producers only
+// contend on enqueue_pos_ and consumers on dequeue_pos_, each on a cache
+// line of its own. push_n() and pop_n() take a run of turns with one CAS.
+//
+// push() and pop() return futures, for producers and consumers that would
+// rather wait than spin. They take the lock-free path when they can and
+// otherwise queue a promise under a lock; every successful operation checks
+// whether anyone waits, with a plain load on x86, and if so serves the
+// waiters, resolving their promises through a promise_batch once the lock is
+// released.
+//
+// A turn cannot be given back once taken, so values are built before one is
+// taken and are only ever move constructed in and out of the slots, which
+// must not throw. T need not be default constructible nor assignable.
+template <typename T>
+class mpmc_ring
+{
+	static_assert(std::is_nothrow_move_constructible<T>::value,
+				  "moving values must not throw");
+
+private:
+	struct slot
+	{
+		std::atomic<size_t> seq;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+
+		T* value() noexcept
+		{
+			return reinterpret_cast<T*>(&data);
+		}
+	};
+
+	struct pending_push
+	{
+		T value;
+		promise<> pr;
+	};
+
+	// Room for a value moved out of its slot.
+	struct taken
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+		bool full{false};
+
+		~taken()
+		{
+			if (full)
+				value()->~T();
+		}
+
+		T* value() noexcept
+		{
+			return reinterpret_cast<T*>(&data);
+		}
+	};
+
+	size_t mask_;
+	std::unique_ptr<slot[]> slots_;
+	char pad0_[64];
+	std::atomic<size_t> enqueue_pos_{0};
+	char pad1_[64];
+	std::atomic<size_t> dequeue_pos_{0};
+	char pad2_[64];
+	// pushes and pops queued, or about to be
+	std::atomic<size_t> waiting_{0};
+	spinlock lock_;
+	circular_buffer<pending_push> pushes_;
+	circular_buffer<promise<T> > pops_;
+
+public:
+	// `capacity` is rounded up to a power of two, at least 2.
+	explicit mpmc_ring(size_t capacity)
+	{
+		size_t n = 2;
+		while (n < capacity)
+		{
+			n *= 2;
+		}
+		mask_ = n - 1;
+		slots_.reset(new slot[n]);
+		for (size_t i = 0; i < n; ++i)
+		{
+			slots_[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	mpmc_ring(const mpmc_ring&) = delete;
+	mpmc_ring& operator=(const mpmc_ring&) = delete;
+
+	~mpmc_ring()
+	{
+		auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+		auto end = enqueue_pos_.load(std::memory_order_relaxed);
+		for (; pos != end; ++pos)
+		{
+			slots_[pos & mask_].value()->~T();
+		}
+	}
+
+	size_t capacity() const noexcept
+	{
+		return mask_ + 1;
+	}
+
+	// A snapshot; only exact while nobody pushes or pops.
+	size_t size() const noexcept
+	{
+		auto deq = dequeue_pos_.load(std::memory_order_acquire);
+		auto enq = enqueue_pos_.load(std::memory_order_acquire);
+		return enq > deq ? enq - deq : 0;
+	}
+
+	bool empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	bool try_push(const T& value)
+	{
+		return try_push(T(value));
+	}
+
+	// Leaves `value` alone when the ring is full.
+	bool try_push(T&& value)
+	{
+		if (!enqueue(std::move(value)))
+			return false;
+		serve_waiters();
+		return true;
+	}
+
+	template <typename... Args>
+	bool try_emplace(Args&&... args)
+	{
+		return try_push(T(std::forward<Args>(args)...));
+	}
+
+	bool try_pop(T& value)
+	{
+		taken t;
+		if (!dequeue(t))
+			return false;
+		serve_waiters();
+		value = std::move(*t.value());
+		return true;
+	}
+
+	// Moves up to `n` values from `first` into consecutive turns; returns how
+	// many there was room for.
+	template <typename InputIt>
+	size_t push_n(InputIt first, size_t n)
+	{
+		size_t pos;
+		n = claim(enqueue_pos_, n, 0, pos);
+		for (size_t i = 0; i < n; ++i, ++first)
+		{
+			auto& s = slots_[(pos + i) & mask_];
+			new (s.value()) T(std::move(*first));
+			s.seq.store(pos + i + 1, std::memory_order_release);
+		}
+		if (n)
+			serve_waiters();
+		return n;
+	}
+
+	// Moves up to `n` values out to `out`; returns how many there were. Should
+	// writing to `out` throw, the rest of the run is dropped.
+	template <typename OutputIt>
+	size_t pop_n(OutputIt out, size_t n)
+	{
+		size_t pos;
+		n = claim(dequeue_pos_, n, 1, pos);
+		size_t i = 0;
+		try
+		{
+			for (; i < n; ++i, ++out)
+			{
+				auto& s = slots_[(pos + i) & mask_];
+				*out = std::move(*s.value());
+				release(s, pos + i);
+			}
+		}
+		catch (...)
+		{
+			for (; i < n; ++i)
+			{
+				release(slots_[(pos + i) & mask_], pos + i);
+			}
+			serve_waiters();
+			throw;
+		}
+		if (n)
+			serve_waiters();
+		return n;
+	}
+
+	// Resolves once the value is in the ring.
+	future<> push(T value)
+	{
+		if (try_push(std::move(value)))
+			return make_ready_future<>();
+		std::unique_lock<spinlock> lock(lock_);
+		announce();
+		if (enqueue(std::move(value)))
+		{
+			waiting_.fetch_sub(1, std::memory_order_relaxed);
+			lock.unlock();
+			serve_waiters();
+			return make_ready_future<>();
+		}
+		pushes_.push_back(pending_push{std::move(value), promise<>()});
+		auto f = pushes_.back().pr.get_future();
+		lock.unlock();
+		// a pop took a turn but has not emptied its slot yet
+		settle(f, [this](size_t enq, size_t deq) { return enq - deq == capacity(); });
+		return f;
+	}
+
+	// Resolves with the oldest value once there is one.
+	future<T> pop()
+	{
+		taken t;
+		if (dequeue(t))
+		{
+			serve_waiters();
+			return make_ready_future<T>(std::move(*t.value()));
+		}
+		std::unique_lock<spinlock> lock(lock_);
+		announce();
+		if (dequeue(t))
+		{
+			waiting_.fetch_sub(1, std::memory_order_relaxed);
+			lock.unlock();
+			serve_waiters();
+			return make_ready_future<T>(std::move(*t.value()));
+		}
+		pops_.push_back(promise<T>());
+		auto f = pops_.back().get_future();
+		lock.unlock();
+		// a push took a turn but has not filled its slot yet
+		settle(f, [](size_t enq, size_t deq) { return enq == deq; });
+		return f;
+	}
+
+private:
+	bool enqueue(T&& value) noexcept
+	{
+		size_t pos;
+		if (!claim(enqueue_pos_, 1, 0, pos))
+			return false;
+		auto& s = slots_[pos & mask_];
+		new (s.value()) T(std::move(value));
+		s.seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool dequeue(taken& out) noexcept
+	{
+		size_t pos;
+		if (!claim(dequeue_pos_, 1, 1, pos))
+			return false;
+		auto& s = slots_[pos & mask_];
+		new (out.value()) T(std::move(*s.value()));
+		out.full = true;
+		release(s, pos);
+		return true;
+	}
+
+	// Empties the slot of turn `pos` for the producer one lap later.
+	void release(slot& s, size_t pos) noexcept
+	{
+		s.value()->~T();
+		s.seq.store(pos + mask_ + 1, std::memory_order_release);
+	}
+
+	// Takes up to `n` consecutive turns from `counter`, as many as have their
+	// slot's sequence at `pos + i + lag`: 0 for producers, 1 for consumers.
+	// Returns how many, the first one in `pos`; none when the ring is full,
+	// or empty.
+	size_t claim(std::atomic<size_t>& counter, size_t n, size_t lag, size_t& pos) noexcept
+	{
+		pos = counter.load(std::memory_order_relaxed);
+		while (true)
+		{
+			size_t k = 0;
+			intptr_t diff = 0;
+			for (; k < n && k <= mask_; ++k)
+			{
+				auto seq = slots_[(pos + k) & mask_].seq.load(std::memory_order_acquire);
+				diff = intptr_t(seq - (pos + k + lag));
+				if (diff != 0)
+					break;
+			}
+			if (k == 0)
+			{
+				if (diff <= 0)
+					return 0;
+				// others took this turn already
+				pos = counter.load(std::memory_order_relaxed);
+				continue;
+			}
+			if (counter.compare_exchange_weak(pos, pos + k, std::memory_order_seq_cst,
+											  std::memory_order_relaxed))
+				return k;
+		}
+	}
+
+	// Counts a caller about to queue, before it looks at the positions once
+	// more. Claims are sequentially consistent too, so either the caller sees
+	// the claim of the operation that would serve it, and waits for that to
+	// finish, or that operation sees the count afterwards in serve_waiters().
+	void announce() noexcept
+	{
+		waiting_.fetch_add(1);
+	}
+
+	// Once queued, and with the lock released, serves the waiters for as long
+	// as a turn taken before announce() is in flight: the operation holding
+	// it may have missed the count. Done when `idle` holds for the positions,
+	// as any operation that makes progress from there sees the count, or when
+	// `f` is resolved.
+	template <typename Future, typename Idle>
+	void settle(const Future& f, Idle idle)
+	{
+		while (!f.ready())
+		{
+			auto deq = dequeue_pos_.load();
+			if (idle(enqueue_pos_.load(), deq))
+				return;
+			serve_waiters();
+			if (f.ready())
+				return;
+			std::this_thread::yield();
+		}
+	}
+
+	void serve_waiters()
+	{
+		if (waiting_.load() == 0)
+			return;
+
+		promise_batch batch;
+		std::lock_guard<spinlock> lock(lock_);
+		bool progress = true;
+		while (progress)
+		{
+			progress = false;
+			while (!pops_.empty() && pops_.front().abandoned())
+			{
+				pops_.pop_front();
+				waiting_.fetch_sub(1, std::memory_order_relaxed);
+			}
+			taken t;
+			if (!pops_.empty() && dequeue(t))
+			{
+				batch.set_value(pops_.front(), std::move(*t.value()));
+				pops_.pop_front();
+				waiting_.fetch_sub(1, std::memory_order_relaxed);
+				progress = true;
+			}
+			if (!pushes_.empty() && enqueue(std::move(pushes_.front().value)))
+			{
+				batch.set_value(pushes_.front().pr);
+				pushes_.pop_front();
+				waiting_.fetch_sub(1, std::memory_order_relaxed);
+				progress = true;
+			}
+		}
+	}
+};
+
+} // namespace dot
@@ -0,0 +1,133 @@
+#include "mpmc_ring.hpp"
+#include "circular_buffer.hpp"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Spreads `per_round` messages over `producers` threads, drained by
+// `consumers` threads, through a ring with `try_push`/`try_pop` member
+// functions. A thread that makes no progress yields, which only matters
+// when threads outnumber cpus.
+template <typename Ring>
+static void run(Ring& ring, int producers, int consumers, long per_round)
+{
+	std::atomic<long> received{0};
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p)
+	{
+		threads.emplace_back(
+			[&ring, p, producers, per_round] {
+				for (long i = p; i < per_round; )
+				{
+					if (ring.try_push(i))
+						i += producers;
+					else
+						std::this_thread::yield();
+				}
+			}
+		);
+	}
+	for (int c = 0; c < consumers; ++c)
+	{
+		threads.emplace_back(
+			[&ring, &received, per_round] {
+				long sum = 0;
+				while (received.load(std::memory_order_relaxed) < per_round)
+				{
+					long v;
+					if (ring.try_pop(v))
+					{
+						sum += v;
+						received.fetch_add(1, std::memory_order_relaxed);
+					}
+					else
+					{
+						std::this_thread::yield();
+					}
+				}
+				benchmark::DoNotOptimize(sum);
+			}
+		);
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+}
+
+// Args: producers, consumers.
+static void mpmc_throughput(benchmark::State& state)
+{
+	constexpr long per_round = 1 << 18;
+	for (auto _ : state)
+	{
+		dot::mpmc_ring<long> ring(4096);
+		run(ring, state.range(0), state.range(1), per_round);
+	}
+	state.SetItemsProcessed(state.iterations() * per_round);
+}
+
+// The same traffic through a circular_buffer under a spinlock.
+struct locked_ring
+{
+	dot::spinlock lock;
+	dot::circular_buffer<long> buffer;
+
+	bool try_push(long v)
+	{
+		std::lock_guard<dot::spinlock> guard(lock);
+		if (buffer.size() == 4096)
+			return false;
+		buffer.push_back(v);
+		return true;
+	}
+
+	bool try_pop(long& v)
+	{
+		std::lock_guard<dot::spinlock> guard(lock);
+		if (buffer.empty())
+			return false;
+		v = buffer.front();
+		buffer.pop_front();
+		return true;
+	}
+};
+
+static void locked_throughput(benchmark::State& state)
+{
+	constexpr long per_round = 1 << 18;
+	for (auto _ : state)
+	{
+		locked_ring ring;
+		run(ring, state.range(0), state.range(1), per_round);
+	}
+	state.SetItemsProcessed(state.iterations() * per_round);
+}
+
+static void producers_consumers(benchmark::internal::Benchmark* b)
+{
+	int n = std::max(2u, std::thread::hardware_concurrency());
+	for (int i = 1; i <= n; i *= 2)
+	{
+		b->Args({i, i});
+	}
+	b->Args({1, n})->Args({n, 1});
+}
+BENCHMARK(mpmc_throughput)->Apply(producers_consumers)->UseRealTime();
+BENCHMARK(locked_throughput)->Apply(producers_consumers)->UseRealTime();
+
+// Push and pop through the futures on one thread.
+static void push_pop_futures(benchmark::State& state)
+{
+	dot::mpmc_ring<long> ring(1024);
+	for (auto _ : state)
+	{
+		ring.push(1);
+		benchmark::DoNotOptimize(ring.pop().get());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(push_pop_futures);
@@ -0,0 +1,202 @@
+#include "gtest/gtest.h"
+#include "mpmc_ring.hpp"
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace dot;
+
+TEST(MpmcRingTest, push_pop)
+{
+	mpmc_ring<std::unique_ptr<int> > ring(3);
+	EXPECT_EQ(ring.capacity(), 4);
+	EXPECT_TRUE(ring.empty());
+	for (int i = 0; i < 4; ++i)
+	{
+		EXPECT_TRUE(ring.try_push(std::make_unique<int>(i)));
+	}
+	EXPECT_FALSE(ring.try_push(std::make_unique<int>(4)));
+	EXPECT_EQ(ring.size(), 4);
+
+	std::unique_ptr<int> p;
+	EXPECT_TRUE(ring.try_pop(p));
+	EXPECT_EQ(*p, 0);
+	EXPECT_TRUE(ring.try_emplace(new int(4)));
+
+	// wraps around
+	for (int i = 1; i <= 4; ++i)
+	{
+		EXPECT_TRUE(ring.try_pop(p));
+		EXPECT_EQ(*p, i);
+	}
+	EXPECT_FALSE(ring.try_pop(p));
+
+	// left over values are destroyed with the ring
+	ring.try_push(std::make_unique<int>(5));
+}
+
+namespace
+{
+
+// Not default constructible.
+struct token
+{
+	std::unique_ptr<int> p;
+
+	explicit token(int v) : p(new int(v)) {}
+};
+
+} // namespace
+
+TEST(MpmcRingTest, no_default)
+{
+	mpmc_ring<token> ring(2);
+	EXPECT_TRUE(ring.try_emplace(1));
+	EXPECT_TRUE(ring.push(token(2)).ready());
+
+	// a value that does not fit stays with the caller
+	token t(3);
+	EXPECT_FALSE(ring.try_push(std::move(t)));
+	ASSERT_TRUE(t.p);
+	auto held = ring.push(std::move(t));
+	EXPECT_FALSE(held.ready());
+
+	token out(0);
+	EXPECT_TRUE(ring.try_pop(out));
+	EXPECT_EQ(*out.p, 1);
+	EXPECT_TRUE(held.ready());
+	std::vector<token> rest;
+	EXPECT_EQ(ring.pop_n(std::back_inserter(rest), 4), 2);
+	EXPECT_EQ(*rest[0].p, 2);
+	EXPECT_EQ(*rest[1].p, 3);
+}
+
+TEST(MpmcRingTest, bulk)
+{
+	mpmc_ring<int> ring(8);
+	std::vector<int> in = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+	EXPECT_EQ(ring.push_n(in.begin(), in.size()), 8);
+
+	std::vector<int> out(5);
+	EXPECT_EQ(ring.pop_n(out.begin(), 5), 5);
+	EXPECT_EQ(out, std::vector<int>({0, 1, 2, 3, 4}));
+	EXPECT_EQ(ring.push_n(in.begin() + 8, 2), 2);
+
+	out.clear();
+	EXPECT_EQ(ring.pop_n(std::back_inserter(out), 100), 5);
+	EXPECT_EQ(out, std::vector<int>({5, 6, 7, 8, 9}));
+	EXPECT_EQ(ring.pop_n(out.begin(), 1), 0);
+}
+
+TEST(MpmcRingTest, futures)
+{
+	mpmc_ring<int> ring(2);
+	EXPECT_TRUE(ring.push(1).ready());
+	EXPECT_TRUE(ring.push(2).ready());
+
+	// full: held back until a pop makes room
+	auto held = ring.push(3);
+	EXPECT_FALSE(held.ready());
+	int v;
+	EXPECT_TRUE(ring.try_pop(v));
+	EXPECT_EQ(v, 1);
+	EXPECT_TRUE(held.ready());
+	EXPECT_EQ(ring.pop().get(), 2);
+	EXPECT_EQ(ring.pop().get(), 3);
+
+	// empty: the next push goes to the waiting pop, dropped ones are skipped
+	ring.pop();
+	auto waiting = ring.pop();
+	EXPECT_FALSE(waiting.ready());
+	EXPECT_TRUE(ring.try_push(4));
+	EXPECT_EQ(waiting.get(), 4);
+	EXPECT_TRUE(ring.empty());
+
+	auto bulk = ring.pop();
+	int in[] = {5, 6};
+	EXPECT_EQ(ring.push_n(in, 2), 2);
+	EXPECT_EQ(bulk.get(), 5);
+	EXPECT_EQ(ring.size(), 1);
+}
+
+TEST(MpmcRingTest, threads)
+{
+	constexpr int producers = 3;
+	constexpr int consumers = 3;
+	constexpr long n = 100000;
+	mpmc_ring<long> ring(64);
+	std::atomic<long> sum{0};
+	std::atomic<long> received{0};
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p)
+	{
+		threads.emplace_back(
+			[&ring, p] {
+				long batch[8];
+				for (long i = p; i < n; )
+				{
+					// every other value by itself, blocking on the future
+					if (i % 2)
+					{
+						ring.push(i).get();
+						i += producers;
+						continue;
+					}
+					size_t k = 0;
+					for (; k < 8 && i < n; ++k, i += producers)
+					{
+						batch[k] = i;
+					}
+					for (size_t pushed = 0; pushed < k; )
+					{
+						auto m = ring.push_n(batch + pushed, k - pushed);
+						if (m == 0)
+							std::this_thread::yield();
+						pushed += m;
+					}
+				}
+			}
+		);
+	}
+	for (int c = 0; c < consumers; ++c)
+	{
+		threads.emplace_back(
+			[&ring, &sum, &received, c] {
+				long buf[8];
+				while (received.load() < n)
+				{
+					if (c == 0)
+					{
+						long v;
+						if (ring.try_pop(v))
+						{
+							sum += v;
+							++received;
+						}
+						else
+						{
+							std::this_thread::yield();
+						}
+						continue;
+					}
+					auto k = ring.pop_n(buf, 8);
+					for (size_t j = 0; j < k; ++j)
+					{
+						sum += buf[j];
+					}
+					received += k;
+					if (k == 0)
+						std::this_thread::yield();
+				}
+			}
+		);
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	EXPECT_EQ(received.load(), n);
+	EXPECT_EQ(sum.load(), n * (n - 1) / 2);
+	EXPECT_TRUE(ring.empty());
+}
@@ -0,0 +1,33 @@
+#include "future.hpp"
+#include <mutex>
+#include <vector>
+
+#pragma once
+
+// An executor for tests: tasks pile up until run_all() runs them on the
+// calling thread.
+struct queue_executor : public dot::executor
+{
+	std::mutex lock_;
+	std::vector<dot::task*> tasks_;
+
+	virtual void add(dot::task* t) noexcept override
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		tasks_.push_back(t);
+	}
+
+	size_t run_all()
+	{
+		std::vector<dot::task*> tasks;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			tasks.swap(tasks_);
+		}
+		for (auto t : tasks)
+		{
+			t->run();
+		}
+		return tasks.size();
+	}
+};
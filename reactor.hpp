@@ -0,0 +1,325 @@
+#include "future.hpp"
+#include "circular_buffer.hpp"
+#include "timer_wheel.hpp"
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <system_error>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#pragma once
+
+namespace dot
+{
+
+// A run loop owning one thread. Tasks scheduled from its own thread go
+// straight to a local run queue; other threads hand them over through an
+// inbox that is spliced into the run queue once per loop iteration.
+//
+// While a reactor runs, it is the local executor of its thread: a then()
+// attached there on a pending future resumes as a push on this reactor's
+// queue instead of running on the setter's stack.
+//
+// Each reactor drives a timer wheel, advanced once per loop iteration. An
+// idle reactor sleeps until the next expiry on a timerfd.
+class reactor final : public executor
+{
+private:
+	circular_buffer<task*> queue_;
+	circular_buffer<task*> inbox_;
+	spinlock inbox_lock_;
+	std::vector<std::function<bool()> > pollers_;
+	std::atomic<bool> stopped_{false};
+	int wakeup_fd_;
+	timer_wheel timers_;
+	int timer_fd_;
+	timer_wheel::clock::time_point timer_armed_{timer_wheel::clock::time_point::max()};
+
+public:
+	// Tasks run back to back before the inbox and the pollers are checked.
+	static constexpr size_t max_batch = 256;
+
+	reactor()
+		: wakeup_fd_(::eventfd(0, EFD_CLOEXEC)),
+		  timer_fd_(::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK))
+	{
+		if (wakeup_fd_ < 0 || timer_fd_ < 0)
+		{
+			auto err = errno;
+			::close(wakeup_fd_);
+			::close(timer_fd_);
+			throw std::system_error(err, std::system_category(), "eventfd");
+		}
+		// room for a full batch before the queues ever have to grow
+		queue_.reserve(max_batch);
+		inbox_.reserve(max_batch);
+	}
+
+	reactor(const reactor&) = delete;
+	reactor& operator=(const reactor&) = delete;
+
+	~reactor()
+	{
+		::close(wakeup_fd_);
+		::close(timer_fd_);
+	}
+
+	// The reactor running on the calling thread, if any.
+	static reactor* local() noexcept
+	{
+		return local_ref();
+	}
+
+	// Throws std::bad_alloc should a queue fail to grow. add() is bound by
+	// the noexcept of the executor interface, like every other executor.
+	void schedule(task* t)
+	{
+		if (local() == this)
+		{
+			queue_.push_back(t);
+			return;
+		}
+
+		bool was_empty;
+		{
+			std::lock_guard<spinlock> lock(inbox_lock_);
+			was_empty = inbox_.empty();
+			inbox_.push_back(t);
+		}
+		if (was_empty)
+			wakeup();
+	}
+
+	virtual void add(task* t) noexcept override
+	{
+		schedule(t);
+	}
+
+	// One lock and at most one wakeup for the whole batch.
+	virtual void add_batch(task** tasks, size_t n) noexcept override
+	{
+		if (local() == this)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				queue_.push_back(tasks[i]);
+			}
+			return;
+		}
+
+		bool was_empty;
+		{
+			std::lock_guard<spinlock> lock(inbox_lock_);
+			was_empty = inbox_.empty();
+			for (size_t i = 0; i < n; ++i)
+			{
+				inbox_.push_back(tasks[i]);
+			}
+		}
+		if (was_empty && n != 0)
+			wakeup();
+	}
+
+	// Pollers run on every loop iteration and return whether they found
+	// work. A poller fed from outside the reactor has to call wakeup(), or
+	// an idle reactor will not notice.
+	void add_poller(std::function<bool()> poller)
+	{
+		pollers_.push_back(std::move(poller));
+	}
+
+	// The timers of this reactor. Only to be used on its own thread; other
+	// threads schedule a task that arms the timer, see dot::sleep().
+	timer_wheel& timers() noexcept
+	{
+		return timers_;
+	}
+
+	void wakeup() noexcept
+	{
+		uint64_t one = 1;
+		auto r = ::write(wakeup_fd_, &one, sizeof(one));
+		(void)r;
+	}
+
+	// Runs until stop(); tasks queued by then are still run.
+	void run()
+	{
+		local_ref() = this;
+		local_executor() = this;
+
+		while (true)
+		{
+			splice_inbox();
+			bool busy = run_batch();
+			for (auto& p : pollers_)
+			{
+				busy |= p();
+			}
+			if (!timers_.empty())
+				busy |= timers_.advance(timer_wheel::clock::now()) != 0;
+
+			if (busy || !queue_.empty())
+				continue;
+			if (stopped_.load(std::memory_order_acquire) && inbox_empty())
+				break;
+			sleep();
+		}
+
+		local_executor() = nullptr;
+		local_ref() = nullptr;
+	}
+
+	void stop() noexcept
+	{
+		stopped_.store(true, std::memory_order_release);
+		wakeup();
+	}
+
+private:
+	static reactor*& local_ref() noexcept
+	{
+		static thread_local reactor* r = nullptr;
+		return r;
+	}
+
+	void splice_inbox()
+	{
+		std::lock_guard<spinlock> lock(inbox_lock_);
+		while (!inbox_.empty())
+		{
+			queue_.push_back(inbox_.front());
+			inbox_.pop_front();
+		}
+	}
+
+	bool inbox_empty()
+	{
+		std::lock_guard<spinlock> lock(inbox_lock_);
+		return inbox_.empty();
+	}
+
+	bool run_batch() noexcept
+	{
+		size_t n = 0;
+		for (; n < max_batch && !queue_.empty(); ++n)
+		{
+			auto t = queue_.front();
+			queue_.pop_front();
+			t->run();
+		}
+		return n != 0;
+	}
+
+	// Blocks until the eventfd is written or the next timer is due. Writes
+	// that happened while the reactor was busy are remembered by the
+	// counter, so none is lost. The timerfd is only reprogrammed when the
+	// next expiry moved.
+	void sleep() noexcept
+	{
+		struct pollfd fds[2] = {
+			{wakeup_fd_, POLLIN, 0},
+			{timer_fd_, POLLIN, 0},
+		};
+		nfds_t n = 1;
+		if (!timers_.empty())
+		{
+			auto next = timers_.next_expiry();
+			if (next != timer_armed_)
+			{
+				auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					next.time_since_epoch()).count();
+				struct itimerspec spec{};
+				spec.it_value.tv_sec = ns / 1000000000;
+				spec.it_value.tv_nsec = ns % 1000000000;
+				::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+				timer_armed_ = next;
+			}
+			n = 2;
+		}
+
+		if (::poll(fds, n, -1) <= 0)
+			return;
+		uint64_t count;
+		if (fds[0].revents & POLLIN)
+		{
+			auto r = ::read(wakeup_fd_, &count, sizeof(count));
+			(void)r;
+		}
+		if (n == 2 && (fds[1].revents & POLLIN))
+		{
+			auto r = ::read(timer_fd_, &count, sizeof(count));
+			(void)r;
+			timer_armed_ = timer_wheel::clock::time_point::max();
+		}
+	}
+};
+
+
+// One reactor per core, each on its own pinned thread.
+class reactor_group
+{
+private:
+	std::vector<std::unique_ptr<reactor> > reactors_;
+	std::vector<std::thread> threads_;
+
+public:
+	explicit reactor_group(size_t n = std::thread::hardware_concurrency())
+	{
+		n = std::max<size_t>(n, 1);
+		for (size_t i = 0; i < n; ++i)
+		{
+			reactors_.push_back(std::make_unique<reactor>());
+		}
+		auto cores = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+		for (size_t i = 0; i < n; ++i)
+		{
+			threads_.emplace_back(
+				[r = reactors_[i].get(), core = i % cores] {
+					cpu_set_t set;
+					CPU_ZERO(&set);
+					CPU_SET(core, &set);
+					pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+					r->run();
+				}
+			);
+		}
+	}
+
+	reactor_group(const reactor_group&) = delete;
+	reactor_group& operator=(const reactor_group&) = delete;
+
+	~reactor_group()
+	{
+		stop();
+	}
+
+	size_t size() const
+	{
+		return reactors_.size();
+	}
+
+	reactor& operator[](size_t i)
+	{
+		return *reactors_[i];
+	}
+
+	void stop()
+	{
+		for (auto& r : reactors_)
+		{
+			r->stop();
+		}
+		for (auto& t : threads_)
+		{
+			if (t.joinable())
+				t.join();
+		}
+	}
+};
+
+} // namespace dot
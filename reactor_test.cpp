@@ -0,0 +1,126 @@
+#include "gtest/gtest.h"
+#include "reactor.hpp"
+
+using namespace dot;
+
+TEST(ReactorTest, schedule)
+{
+	reactor r;
+	std::thread::id where;
+	std::thread t(
+		[&r, &where] {
+			where = std::this_thread::get_id();
+			r.run();
+		}
+	);
+
+	std::atomic<int> counter{0};
+	std::atomic<int> foreign{0};
+	for (int i = 0; i < 1000; i++)
+	{
+		r.schedule(make_task(
+			[&] {
+				counter++;
+				if (reactor::local() != &r)
+					foreign++;
+			}
+		));
+	}
+	r.stop();
+	t.join();
+
+	EXPECT_EQ(counter, 1000);
+	EXPECT_EQ(foreign, 0);
+	EXPECT_NE(where, std::this_thread::get_id());
+}
+
+TEST(ReactorTest, local_schedule)
+{
+	reactor r;
+	std::vector<int> order;
+	r.schedule(make_task(
+		[&] {
+			order.push_back(1);
+			r.schedule(make_task(
+				[&] {
+					order.push_back(3);
+					r.stop();
+				}
+			));
+			order.push_back(2);
+		}
+	));
+	r.run();
+	EXPECT_EQ(order, std::vector<int>({1, 2, 3}));
+	EXPECT_EQ(reactor::local(), nullptr);
+}
+
+TEST(ReactorTest, poller)
+{
+	reactor r;
+	int polled = 0;
+	r.add_poller(
+		[&] {
+			if (++polled == 3)
+				r.stop();
+			return polled < 3;
+		}
+	);
+	r.run();
+	EXPECT_EQ(polled, 3);
+}
+
+TEST(ReactorTest, then_resumes_on_reactor)
+{
+	reactor r;
+	std::thread t([&r] { r.run(); });
+
+	promise<int> pr;
+	auto fut = pr.get_future();
+	future<std::thread::id> res;
+	std::promise<std::thread::id> attached;
+
+	r.schedule(make_task(
+		[&] {
+			res = fut.then(
+				[](future<int> f) {
+					EXPECT_EQ(f.get(), 13);
+					return std::this_thread::get_id();
+				}
+			);
+			attached.set_value(std::this_thread::get_id());
+		}
+	));
+	auto reactor_id = attached.get_future().get();
+
+	std::thread setter([&pr] { pr.set_value(13); });
+	auto setter_id = setter.get_id();
+	setter.join();
+
+	auto where = res.get();
+	EXPECT_EQ(where, reactor_id);
+	EXPECT_NE(where, setter_id);
+
+	r.stop();
+	t.join();
+}
+
+TEST(ReactorTest, group)
+{
+	reactor_group group(2);
+	EXPECT_EQ(group.size(), 2);
+
+	std::vector<future<std::thread::id> > ids;
+	for (size_t i = 0; i < group.size(); i++)
+	{
+		promise<std::thread::id> pr;
+		ids.push_back(pr.get_future());
+		group[i].schedule(make_task(
+			[pr = std::move(pr)]() mutable {
+				pr.set_value(std::this_thread::get_id());
+			}
+		));
+	}
+	EXPECT_NE(ids[0].get(), ids[1].get());
+	group.stop();
+}
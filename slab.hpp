@@ -0,0 +1,397 @@
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#pragma once
+
+namespace dot
+{
+
+// Counters of a slab heap. `frees` counts the blocks given back to the
+// heap, by its own thread or reclaimed from the others; `remote_frees` is
+// the part that came from other threads. Blocks freed remotely still count
+// as in use until the owner reclaims them on its next refill.
+struct slab_stats
+{
+	uint64_t allocations{0};
+	uint64_t frees{0};
+	uint64_t remote_frees{0};
+	size_t bytes_in_use{0};
+	size_t bytes_reserved{0};
+
+	slab_stats& operator+=(const slab_stats& x) noexcept
+	{
+		allocations += x.allocations;
+		frees += x.frees;
+		remote_frees += x.remote_frees;
+		bytes_in_use += x.bytes_in_use;
+		bytes_reserved += x.bytes_reserved;
+		return *this;
+	}
+};
+
+
+// The blocks of one thread, in size classes of 16 bytes up to `max_size`.
+// Each class carves its blocks from slabs of its own; a slab starts with a
+// header naming the heap it belongs to, so a free finds the owner from the
+// address alone. The owning thread allocates and frees without any atomic
+// read-modify-write. Other threads push what they free onto the owner's
+// remote list, which the owner takes over as a whole once a class runs dry.
+//
+// Heaps are never destroyed: a block may be freed long after its thread
+// exited. The heap of an exiting thread is handed to the next new thread,
+// together with its free blocks.
+class slab_heap
+{
+public:
+	static constexpr size_t slab_size = 64 * 1024;
+	static constexpr size_t granule = 16;
+	static constexpr size_t max_size = 512;
+	static constexpr size_t classes = max_size / granule;
+
+private:
+	struct block
+	{
+		block* next;
+	};
+
+	struct slab
+	{
+		slab_heap* owner;
+		size_t size;
+	};
+
+	// Keeps the first block off the header's cache line.
+	static constexpr size_t header_size = 64;
+
+	std::array<block*, classes> free_{};
+	std::array<char*, classes> carve_{};
+	std::array<char*, classes> end_{};
+
+	// Written by the owner only; atomic so that total_stats() can read them.
+	std::atomic<uint64_t> allocations_{0};
+	std::atomic<uint64_t> frees_{0};
+	std::atomic<uint64_t> remote_frees_{0};
+	std::atomic<size_t> bytes_in_use_{0};
+	std::atomic<size_t> bytes_reserved_{0};
+
+	char pad_[64];
+	std::atomic<block*> remote_{nullptr};
+
+public:
+	slab_heap() noexcept {}
+	slab_heap(const slab_heap&) = delete;
+	slab_heap& operator=(const slab_heap&) = delete;
+
+	static size_t class_of(size_t size) noexcept
+	{
+		return (size - 1) / granule;
+	}
+
+	static slab_heap* owner_of(void* p) noexcept
+	{
+		return slab_of(p)->owner;
+	}
+
+	// `size` must be at most max_size.
+	void* allocate(size_t size)
+	{
+		auto c = class_of(size);
+		auto b = free_[c];
+		if (!b)
+			b = refill(c);
+		free_[c] = b->next;
+		bump(allocations_, 1);
+		bump(bytes_in_use_, (c + 1) * granule);
+		return b;
+	}
+
+	// A block of this heap, freed on the owning thread.
+	void deallocate(void* p) noexcept
+	{
+		auto c = class_of(slab_of(p)->size);
+		auto b = static_cast<block*>(p);
+		b->next = free_[c];
+		free_[c] = b;
+		bump(frees_, 1);
+		bump(bytes_in_use_, -(c + 1) * granule);
+	}
+
+	// A block of this heap, freed on any other thread.
+	void deallocate_remote(void* p) noexcept
+	{
+		auto b = static_cast<block*>(p);
+		b->next = remote_.load(std::memory_order_relaxed);
+		while (!remote_.compare_exchange_weak(b->next, b,
+											  std::memory_order_release,
+											  std::memory_order_relaxed))
+		{
+		}
+	}
+
+	slab_stats stats() const noexcept
+	{
+		slab_stats s;
+		s.allocations = allocations_.load(std::memory_order_relaxed);
+		s.frees = frees_.load(std::memory_order_relaxed);
+		s.remote_frees = remote_frees_.load(std::memory_order_relaxed);
+		s.bytes_in_use = bytes_in_use_.load(std::memory_order_relaxed);
+		s.bytes_reserved = bytes_reserved_.load(std::memory_order_relaxed);
+		return s;
+	}
+
+private:
+	template <typename U, typename D>
+	static void bump(std::atomic<U>& counter, D delta) noexcept
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + U(delta),
+					  std::memory_order_relaxed);
+	}
+
+	static slab* slab_of(void* p) noexcept
+	{
+		return reinterpret_cast<slab*>(reinterpret_cast<uintptr_t>(p) & ~(slab_size - 1));
+	}
+
+	// Takes back the remote frees, then carves a new block if class `c` is
+	// still empty.
+	block* refill(size_t c)
+	{
+		reclaim();
+		if (auto b = free_[c])
+			return b;
+
+		auto size = (c + 1) * granule;
+		if (carve_[c] + size > end_[c])
+		{
+			void* p = nullptr;
+			if (posix_memalign(&p, slab_size, slab_size) != 0)
+				throw std::bad_alloc();
+			auto s = static_cast<slab*>(p);
+			s->owner = this;
+			s->size = size;
+			carve_[c] = static_cast<char*>(p) + header_size;
+			end_[c] = static_cast<char*>(p) + slab_size;
+			bump(bytes_reserved_, slab_size);
+		}
+		auto b = reinterpret_cast<block*>(carve_[c]);
+		carve_[c] += size;
+		b->next = nullptr;
+		return b;
+	}
+
+	void reclaim() noexcept
+	{
+		if (!remote_.load(std::memory_order_relaxed))
+			return;
+		auto b = remote_.exchange(nullptr, std::memory_order_acquire);
+		uint64_t count = 0;
+		while (b)
+		{
+			auto next = b->next;
+			deallocate(b);
+			count++;
+			b = next;
+		}
+		bump(remote_frees_, count);
+	}
+};
+
+
+// Allocates from the calling thread's slab_heap, or from operator new for
+// blocks above slab_heap::max_size. Freeing is fine on any thread.
+//
+// Heaps are never destroyed and their slabs never returned to the system:
+// a thread that exits leaves its heap to the next one that allocates, and
+// memory reserved at the peak stays reserved for the life of the process.
+struct slab_allocator
+{
+	static void* allocate(size_t size)
+	{
+		if (size > slab_heap::max_size)
+			return ::operator new(size);
+		auto heap = local();
+		if (!heap)
+		{
+			if (retired())
+				return allocate_retired(size);
+			heap = acquire();
+		}
+		return heap->allocate(size);
+	}
+
+	static void deallocate(void* p, size_t size) noexcept
+	{
+		if (size > slab_heap::max_size)
+			return ::operator delete(p);
+		auto owner = slab_heap::owner_of(p);
+		if (owner == local())
+			owner->deallocate(p);
+		else
+			owner->deallocate_remote(p);
+	}
+
+	// The heap of the calling thread; empty if it has not allocated yet.
+	static slab_stats local_stats() noexcept
+	{
+		if (auto heap = local())
+			return heap->stats();
+		return slab_stats();
+	}
+
+	// All heaps together. The counters of the other threads may lag.
+	static slab_stats total_stats()
+	{
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.lock);
+		slab_stats total;
+		for (auto heap : r.heaps)
+		{
+			total += heap->stats();
+		}
+		return total;
+	}
+
+private:
+	struct heap_registry
+	{
+		std::mutex lock;
+		std::vector<slab_heap*> heaps;
+		std::vector<slab_heap*> idle;
+	};
+
+	// Gives the heap back for reuse when the thread exits.
+	struct lease
+	{
+		~lease()
+		{
+			give_back(local());
+			local() = nullptr;
+			retired() = true;
+		}
+	};
+
+	static slab_heap*& local() noexcept
+	{
+		static thread_local slab_heap* heap = nullptr;
+		return heap;
+	}
+
+	// Whether the lease of the calling thread has ended, with destructors of
+	// thread_local objects still to run.
+	static bool& retired() noexcept
+	{
+		static thread_local bool r = false;
+		return r;
+	}
+
+	// Never destroyed, blocks are freed during static destruction too.
+	static heap_registry& registry()
+	{
+		static auto r = new heap_registry();
+		return *r;
+	}
+
+	static slab_heap* acquire()
+	{
+		static thread_local lease l;
+		local() = take();
+		return local();
+	}
+
+	// Past the end of the lease, a heap is borrowed for the one block, which
+	// is then freed remotely like any other.
+	static void* allocate_retired(size_t size)
+	{
+		auto heap = take();
+		void* p;
+		try
+		{
+			p = heap->allocate(size);
+		}
+		catch (...)
+		{
+			give_back(heap);
+			throw;
+		}
+		give_back(heap);
+		return p;
+	}
+
+	static slab_heap* take()
+	{
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.lock);
+		if (r.idle.empty())
+		{
+			r.heaps.push_back(new slab_heap());
+			return r.heaps.back();
+		}
+		auto heap = r.idle.back();
+		r.idle.pop_back();
+		return heap;
+	}
+
+	static void give_back(slab_heap* heap)
+	{
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.lock);
+		r.idle.push_back(heap);
+	}
+};
+
+
+// Plain operator new, for comparison or when pooling is not wanted.
+struct heap_allocator
+{
+	static void* allocate(size_t size)
+	{
+		return ::operator new(size);
+	}
+
+	static void deallocate(void* p, size_t) noexcept
+	{
+		::operator delete(p);
+	}
+};
+
+
+// Where the states, continuations, tasks and contexts of this library are
+// allocated. They tend to be freed on another thread than the one that
+// allocated them, which the per-thread slabs of slab_allocator take in
+// stride; build with -DDOT_INTERNAL_ALLOCATOR=dot::heap_allocator to go
+// through operator new instead.
+#ifndef DOT_INTERNAL_ALLOCATOR
+#define DOT_INTERNAL_ALLOCATOR ::dot::slab_allocator
+#endif
+
+using internal_allocator = DOT_INTERNAL_ALLOCATOR;
+
+// Makes new and delete of a class go through internal_allocator.
+struct pooled
+{
+	static void* operator new(size_t size)
+	{
+		return internal_allocator::allocate(size);
+	}
+
+	static void operator delete(void* p, size_t size) noexcept
+	{
+		internal_allocator::deallocate(p, size);
+	}
+
+	// Still allowed in place, e.g. hops inside a future_state.
+	static void* operator new(size_t, void* p) noexcept
+	{
+		return p;
+	}
+
+	static void operator delete(void*, void*) noexcept {}
+};
+
+} // namespace dot
@@ -0,0 +1,161 @@
+#include "gtest/gtest.h"
+#include "future.hpp"
+#include <thread>
+
+using namespace dot;
+
+TEST(SlabTest, reuse)
+{
+	auto before = slab_allocator::local_stats();
+	auto a = slab_allocator::allocate(40);
+	auto b = slab_allocator::allocate(48);
+	EXPECT_NE(a, b);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % alignof(std::max_align_t), 0);
+
+	auto during = slab_allocator::local_stats();
+	EXPECT_EQ(during.allocations - before.allocations, 2);
+	EXPECT_EQ(during.bytes_in_use - before.bytes_in_use, 96);
+
+	// same size class, last in first out
+	slab_allocator::deallocate(a, 40);
+	EXPECT_EQ(slab_allocator::allocate(33), a);
+	slab_allocator::deallocate(a, 33);
+	slab_allocator::deallocate(b, 48);
+
+	auto after = slab_allocator::local_stats();
+	EXPECT_EQ(after.frees - before.frees, 3);
+	EXPECT_EQ(after.bytes_in_use, before.bytes_in_use);
+}
+
+TEST(SlabTest, large)
+{
+	auto before = slab_allocator::local_stats();
+	auto p = slab_allocator::allocate(slab_heap::max_size + 1);
+	slab_allocator::deallocate(p, slab_heap::max_size + 1);
+	EXPECT_EQ(slab_allocator::local_stats().allocations, before.allocations);
+}
+
+TEST(SlabTest, remote_free)
+{
+	std::vector<void*> blocks;
+	for (int i = 0; i < 100; ++i)
+	{
+		blocks.push_back(slab_allocator::allocate(64));
+	}
+	auto before = slab_allocator::local_stats();
+
+	std::thread freer(
+		[&blocks] {
+			for (auto p : blocks)
+			{
+				slab_allocator::deallocate(p, 64);
+			}
+			// never allocated here, so no heap of its own
+			EXPECT_EQ(slab_allocator::local_stats().allocations, 0);
+		}
+	);
+	freer.join();
+	EXPECT_EQ(slab_allocator::local_stats().frees, before.frees);
+
+	// taken back once the class runs dry
+	std::vector<void*> again;
+	auto reserved = before.bytes_reserved;
+	while (slab_allocator::local_stats().remote_frees - before.remote_frees < blocks.size())
+	{
+		again.push_back(slab_allocator::allocate(64));
+	}
+	EXPECT_EQ(slab_allocator::local_stats().bytes_reserved, reserved);
+	for (auto p : again)
+	{
+		slab_allocator::deallocate(p, 64);
+	}
+}
+
+TEST(SlabTest, future_states)
+{
+	// states allocated here and freed by the setter's continuation
+	auto before = slab_allocator::total_stats();
+	std::vector<promise<int> > promises(1000);
+	std::vector<future<int> > results;
+	for (auto& pr : promises)
+	{
+		results.push_back(pr.get_future().then([](future<int> f) { return f.get() + 1; }));
+	}
+	std::thread setter(
+		[&promises] {
+			for (size_t i = 0; i < promises.size(); ++i)
+			{
+				promises[i].set_value(i);
+			}
+		}
+	);
+	setter.join();
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		EXPECT_EQ(results[i].get(), int(i + 1));
+	}
+	promises.clear();
+	results.clear();
+
+	auto after = slab_allocator::total_stats();
+	EXPECT_GE(after.allocations - before.allocations, 2000);
+}
+
+TEST(SlabTest, thread_exit)
+{
+	// the heap of a finished thread goes to the next one
+	slab_heap* first = nullptr;
+	slab_heap* second = nullptr;
+	void* p = nullptr;
+	std::thread a(
+		[&] {
+			p = slab_allocator::allocate(16);
+			first = slab_heap::owner_of(p);
+		}
+	);
+	a.join();
+	std::thread b(
+		[&] {
+			auto q = slab_allocator::allocate(16);
+			second = slab_heap::owner_of(q);
+			slab_allocator::deallocate(q, 16);
+		}
+	);
+	b.join();
+	EXPECT_EQ(first, second);
+	slab_allocator::deallocate(p, 16);
+}
+
+namespace
+{
+
+std::atomic<bool> late_allocated{false};
+
+// Destroyed after the lease of its thread, for being constructed first.
+struct late_allocation
+{
+	~late_allocation()
+	{
+		slab_allocator::deallocate(slab_allocator::allocate(16), 16);
+		late_allocated = true;
+	}
+};
+
+} // namespace
+
+TEST(SlabTest, after_thread_exit)
+{
+	// allocations after the lease ended leave no heap taken
+	std::thread warm([] { slab_allocator::deallocate(slab_allocator::allocate(16), 16); });
+	warm.join();
+	auto idle = slab_allocator::registry().idle.size();
+	std::thread late(
+		[] {
+			static thread_local late_allocation l;
+			slab_allocator::deallocate(slab_allocator::allocate(16), 16);
+		}
+	);
+	late.join();
+	EXPECT_TRUE(late_allocated);
+	EXPECT_EQ(slab_allocator::registry().idle.size(), idle);
+}
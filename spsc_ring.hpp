@@ -0,0 +1,177 @@
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#pragma once
+
+namespace dot
+{
+
+// A fixed-size ring between exactly one producer thread and one consumer
+// thread, without locks. Slots are indexed with the power-of-two masking of
+// circular_buffer; the producer owns tail_, the consumer head_, each on a
+// cache line of its own. Each side also keeps the last value it read of
+// the other's index and only reloads it when the ring looks full, or
+// empty, so that in steady state the two cores touch each other's line
+// once per wrap rather than once per message. push_n() and pop_n() move a
+// whole run of values for a single index update.
+//
+// The ring is over-aligned; allocating one with new takes C++17, or
+// -faligned-new before that.
+template <typename T, size_t Capacity>
+class spsc_ring
+{
+	static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0,
+				  "capacity must be a power of two");
+
+private:
+	// producer's line
+	alignas(64) std::atomic<size_t> tail_{0};
+	size_t cached_head_{0};
+	// consumer's line
+	alignas(64) std::atomic<size_t> head_{0};
+	size_t cached_tail_{0};
+	alignas(64) typename std::aligned_storage<sizeof(T), alignof(T)>::type slots_[Capacity];
+
+public:
+	spsc_ring() noexcept {}
+	spsc_ring(const spsc_ring&) = delete;
+	spsc_ring& operator=(const spsc_ring&) = delete;
+
+	~spsc_ring()
+	{
+		auto head = head_.load(std::memory_order_relaxed);
+		auto tail = tail_.load(std::memory_order_relaxed);
+		for (; head != tail; ++head)
+		{
+			slot(head)->~T();
+		}
+	}
+
+	static constexpr size_t capacity() noexcept
+	{
+		return Capacity;
+	}
+
+	// Exact only on the producer or the consumer thread while the other is
+	// idle.
+	size_t size() const noexcept
+	{
+		return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+	}
+
+	bool empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	// Producer only.
+	template <typename... Args>
+	bool try_emplace(Args&&... args)
+	{
+		auto tail = tail_.load(std::memory_order_relaxed);
+		if (tail - cached_head_ == Capacity)
+		{
+			cached_head_ = head_.load(std::memory_order_acquire);
+			if (tail - cached_head_ == Capacity)
+				return false;
+		}
+		new (slot(tail)) T(std::forward<Args>(args)...);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_push(const T& value)
+	{
+		return try_emplace(value);
+	}
+
+	bool try_push(T&& value)
+	{
+		return try_emplace(std::move(value));
+	}
+
+	// Producer only. Moves up to `n` values from `first` in; returns how
+	// many fit.
+	template <typename InputIt>
+	size_t push_n(InputIt first, size_t n)
+	{
+		auto tail = tail_.load(std::memory_order_relaxed);
+		if (Capacity - (tail - cached_head_) < n)
+			cached_head_ = head_.load(std::memory_order_acquire);
+		n = std::min(n, Capacity - (tail - cached_head_));
+		size_t i = 0;
+		try
+		{
+			for (; i < n; ++i, ++first)
+			{
+				new (slot(tail + i)) T(std::move(*first));
+			}
+		}
+		catch (...)
+		{
+			// what was constructed goes out
+			tail_.store(tail + i, std::memory_order_release);
+			throw;
+		}
+		tail_.store(tail + n, std::memory_order_release);
+		return n;
+	}
+
+	// Consumer only.
+	bool try_pop(T& value)
+	{
+		auto head = head_.load(std::memory_order_relaxed);
+		if (head == cached_tail_)
+		{
+			cached_tail_ = tail_.load(std::memory_order_acquire);
+			if (head == cached_tail_)
+				return false;
+		}
+		auto p = slot(head);
+		value = std::move(*p);
+		p->~T();
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only. Moves up to `n` values out to `out`; returns how many
+	// there were.
+	template <typename OutputIt>
+	size_t pop_n(OutputIt out, size_t n)
+	{
+		auto head = head_.load(std::memory_order_relaxed);
+		if (cached_tail_ - head < n)
+			cached_tail_ = tail_.load(std::memory_order_acquire);
+		n = std::min(n, cached_tail_ - head);
+		size_t i = 0;
+		try
+		{
+			for (; i < n; ++i, ++out)
+			{
+				auto p = slot(head + i);
+				*out = std::move(*p);
+				p->~T();
+			}
+		}
+		catch (...)
+		{
+			// what was moved out is gone, the value that failed stays
+			head_.store(head + i, std::memory_order_release);
+			throw;
+		}
+		head_.store(head + n, std::memory_order_release);
+		return n;
+	}
+
+private:
+	T* slot(size_t idx) noexcept
+	{
+		return reinterpret_cast<T*>(&slots_[idx & (Capacity - 1)]);
+	}
+};
+
+} // namespace dot
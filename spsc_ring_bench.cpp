@@ -0,0 +1,90 @@
+#include "spsc_ring.hpp"
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+
+
+// Pins the calling thread to `cpu`, if there is such a cpu.
+static void pin(unsigned cpu)
+{
+	if (cpu >= std::thread::hardware_concurrency())
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Messages from a producer pinned to cpu 1 to the benchmark thread on cpu
+// 0. Arg: messages moved per push_n()/pop_n(), 1 meaning try_push() and
+// try_pop(). A side that finds the ring full, or empty, yields, which only
+// matters when both share a cpu.
+static void spsc_throughput(benchmark::State& state)
+{
+	constexpr long per_round = 1 << 20;
+	auto batch = size_t(state.range(0));
+	pin(0);
+	for (auto _ : state)
+	{
+		auto ring = std::make_unique<dot::spsc_ring<long, 4096> >();
+		std::thread producer(
+			[&ring, batch] {
+				pin(1);
+				long buf[256];
+				for (long i = 0; i < per_round; )
+				{
+					if (batch == 1)
+					{
+						if (ring->try_push(i))
+							++i;
+						else
+							std::this_thread::yield();
+						continue;
+					}
+					auto k = std::min<long>(batch, per_round - i);
+					for (long j = 0; j < k; ++j)
+					{
+						buf[j] = i + j;
+					}
+					auto pushed = ring->push_n(buf, k);
+					if (pushed == 0)
+						std::this_thread::yield();
+					i += pushed;
+				}
+			}
+		);
+		long sum = 0;
+		long buf[256];
+		for (long received = 0; received < per_round; )
+		{
+			if (batch == 1)
+			{
+				long v;
+				if (ring->try_pop(v))
+				{
+					sum += v;
+					++received;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+				continue;
+			}
+			auto k = ring->pop_n(buf, batch);
+			for (size_t j = 0; j < k; ++j)
+			{
+				sum += buf[j];
+			}
+			received += k;
+			if (k == 0)
+				std::this_thread::yield();
+		}
+		producer.join();
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * per_round);
+}
+BENCHMARK(spsc_throughput)->Arg(1)->Arg(16)->Arg(256)->UseRealTime();
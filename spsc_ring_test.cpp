@@ -0,0 +1,131 @@
+#include "gtest/gtest.h"
+#include "spsc_ring.hpp"
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace dot;
+
+TEST(SpscRingTest, push_pop)
+{
+	spsc_ring<std::unique_ptr<int>, 4> ring;
+	EXPECT_TRUE(ring.empty());
+	for (int i = 0; i < 4; ++i)
+	{
+		EXPECT_TRUE(ring.try_push(std::make_unique<int>(i)));
+	}
+	EXPECT_FALSE(ring.try_push(std::make_unique<int>(4)));
+	EXPECT_EQ(ring.size(), 4);
+
+	std::unique_ptr<int> p;
+	EXPECT_TRUE(ring.try_pop(p));
+	EXPECT_EQ(*p, 0);
+	EXPECT_TRUE(ring.try_emplace(new int(4)));
+
+	// wraps around
+	for (int i = 1; i <= 4; ++i)
+	{
+		EXPECT_TRUE(ring.try_pop(p));
+		EXPECT_EQ(*p, i);
+	}
+	EXPECT_FALSE(ring.try_pop(p));
+
+	// left over values are destroyed with the ring
+	ring.try_push(std::make_unique<int>(5));
+}
+
+TEST(SpscRingTest, bulk)
+{
+	spsc_ring<int, 8> ring;
+	std::vector<int> in = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+	EXPECT_EQ(ring.push_n(in.begin(), in.size()), 8);
+
+	std::vector<int> out(5);
+	EXPECT_EQ(ring.pop_n(out.begin(), 5), 5);
+	EXPECT_EQ(out, std::vector<int>({0, 1, 2, 3, 4}));
+	EXPECT_EQ(ring.push_n(in.begin() + 8, 2), 2);
+
+	out.clear();
+	EXPECT_EQ(ring.pop_n(std::back_inserter(out), 100), 5);
+	EXPECT_EQ(out, std::vector<int>({5, 6, 7, 8, 9}));
+}
+
+namespace
+{
+
+// Refuses the value 2.
+struct picky
+{
+	int value{-1};
+
+	picky& operator=(int&& v)
+	{
+		if (v == 2)
+			throw std::runtime_error("2");
+		value = v;
+		return *this;
+	}
+};
+
+} // namespace
+
+TEST(SpscRingTest, bulk_throw)
+{
+	spsc_ring<int, 8> ring;
+	int in[] = {0, 1, 2, 3, 4};
+	EXPECT_EQ(ring.push_n(in, 5), 5);
+
+	// the values moved out before the throw are gone, the rest stay
+	picky out[5];
+	EXPECT_THROW(ring.pop_n(out, 5), std::runtime_error);
+	EXPECT_EQ(out[1].value, 1);
+	EXPECT_EQ(ring.size(), 3);
+	int v;
+	EXPECT_TRUE(ring.try_pop(v));
+	EXPECT_EQ(v, 2);
+}
+
+TEST(SpscRingTest, threads)
+{
+	constexpr long n = 1000000;
+	auto ring = std::make_unique<spsc_ring<long, 1024> >();
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(&ring->tail_) % 64, 0);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(&ring->head_) % 64, 0);
+	std::thread producer(
+		[&ring] {
+			long batch[16];
+			for (long i = 0; i < n; )
+			{
+				auto k = std::min<long>(16, n - i);
+				for (long j = 0; j < k; ++j)
+				{
+					batch[j] = i + j;
+				}
+				long pushed = ring->push_n(batch, k);
+				// what did not fit goes in one by one
+				for (long j = pushed; j < k; ++j)
+				{
+					while (!ring->try_push(batch[j]))
+						std::this_thread::yield();
+				}
+				i += k;
+			}
+		}
+	);
+
+	long expected = 0;
+	long out[32];
+	while (expected < n)
+	{
+		auto k = ring->pop_n(out, 32);
+		for (size_t j = 0; j < k; ++j)
+		{
+			ASSERT_EQ(out[j], expected++);
+		}
+		if (k == 0)
+			std::this_thread::yield();
+	}
+	producer.join();
+	EXPECT_TRUE(ring->empty());
+}
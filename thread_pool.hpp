@@ -0,0 +1,339 @@
+#include "future.hpp"
+#include "circular_buffer.hpp"
+#include <mutex>
+
+#pragma once
+
+namespace dot
+{
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). The owner pushes and takes at the
+// bottom; any thread may steal from the top. The ring uses the same
+// power-of-two masking as circular_buffer and grows when full; retired
+// rings are kept until the deque dies, as thieves may still be reading them.
+template <typename T>
+class chase_lev_deque
+{
+	static_assert(std::is_trivially_copyable<T>::value, "deque slots are copied racily");
+
+private:
+	struct ring
+	{
+		int64_t capacity;
+		std::unique_ptr<std::atomic<T>[]> slots;
+
+		explicit ring(int64_t n)
+			: capacity(n),
+			  slots(new std::atomic<T>[n])
+		{}
+
+		T get(int64_t i) const noexcept
+		{
+			return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+		}
+
+		void put(int64_t i, T x) noexcept
+		{
+			slots[i & (capacity - 1)].store(x, std::memory_order_relaxed);
+		}
+	};
+
+	// thieves hammer top_, the owner bottom_: keep them a cache line apart
+	std::atomic<int64_t> top_{0};
+	char pad_[64];
+	std::atomic<int64_t> bottom_{0};
+	std::atomic<ring*> ring_;
+	std::vector<std::unique_ptr<ring> > rings_;
+
+public:
+	explicit chase_lev_deque(int64_t capacity = 256)
+	{
+		rings_.push_back(std::make_unique<ring>(capacity));
+		ring_.store(rings_.back().get(), std::memory_order_relaxed);
+	}
+
+	chase_lev_deque(const chase_lev_deque&) = delete;
+	chase_lev_deque& operator=(const chase_lev_deque&) = delete;
+
+	bool empty() const noexcept
+	{
+		return bottom_.load() <= top_.load();
+	}
+
+	// Owner only.
+	void push(T x)
+	{
+		auto b = bottom_.load(std::memory_order_relaxed);
+		auto t = top_.load(std::memory_order_acquire);
+		auto r = ring_.load(std::memory_order_relaxed);
+		if (b - t > r->capacity - 1)
+		{
+			r = grow(r, t, b);
+		}
+		r->put(b, x);
+		bottom_.store(b + 1, std::memory_order_release);
+	}
+
+	// Owner only.
+	bool take(T& x) noexcept
+	{
+		auto b = bottom_.load(std::memory_order_relaxed) - 1;
+		auto r = ring_.load(std::memory_order_relaxed);
+		bottom_.store(b);
+		auto t = top_.load();
+		if (t > b)
+		{
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+		x = r->get(b);
+		if (t == b)
+		{
+			// last element: race the thieves for it
+			bool won = top_.compare_exchange_strong(t, t + 1);
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	// Any thread. Fails on an empty deque and on a lost race.
+	bool steal(T& x) noexcept
+	{
+		auto t = top_.load();
+		auto b = bottom_.load();
+		if (t >= b)
+			return false;
+		auto r = ring_.load(std::memory_order_acquire);
+		x = r->get(t);
+		return top_.compare_exchange_strong(t, t + 1);
+	}
+
+private:
+	ring* grow(ring* old, int64_t t, int64_t b)
+	{
+		rings_.push_back(std::make_unique<ring>(old->capacity * 2));
+		auto r = rings_.back().get();
+		for (auto i = t; i != b; ++i)
+		{
+			r->put(i, old->get(i));
+		}
+		ring_.store(r, std::memory_order_release);
+		return r;
+	}
+};
+
+
+// Fixed set of worker threads, each owning a chase_lev_deque. Tasks added
+// by a worker go to its own deque and run LIFO; idle workers steal FIFO
+// from random victims. Tasks from other threads are injected through a
+// shared queue. Workers with nothing to do park on a futex.
+//
+// Workers are the local executor of their thread, so a then() attached
+// inside a task resumes on the pool.
+class thread_pool final : public executor
+{
+private:
+	struct worker
+	{
+		chase_lev_deque<task*> deque;
+		std::thread thread;
+		uint64_t seed;
+	};
+
+	std::vector<std::unique_ptr<worker> > workers_;
+	circular_buffer<task*> injected_;
+	spinlock inject_lock_;
+	std::atomic<size_t> injected_size_{0};
+	std::atomic<uint32_t> epoch_{0};
+	std::atomic<uint32_t> sleepers_{0};
+	std::atomic<bool> stopped_{false};
+
+public:
+	explicit thread_pool(size_t n = std::thread::hardware_concurrency())
+	{
+		n = std::max<size_t>(n, 1);
+		for (size_t i = 0; i < n; ++i)
+		{
+			workers_.push_back(std::make_unique<worker>());
+			workers_.back()->seed = i * 0x9e3779b97f4a7c15ull + 1;
+		}
+		for (size_t i = 0; i < n; ++i)
+		{
+			workers_[i]->thread = std::thread(&thread_pool::work, this, i);
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	// Runs what is still queued, then joins the workers.
+	~thread_pool()
+	{
+		stopped_.store(true);
+		epoch_.fetch_add(1);
+		futex_wake(epoch_);
+		for (auto& w : workers_)
+		{
+			w->thread.join();
+		}
+	}
+
+	size_t size() const
+	{
+		return workers_.size();
+	}
+
+	virtual size_t concurrency() const noexcept override
+	{
+		return workers_.size();
+	}
+
+	virtual void add(task* t) noexcept override
+	{
+		auto& self = current();
+		if (self.pool == this)
+		{
+			workers_[self.index]->deque.push(t);
+		}
+		else
+		{
+			std::lock_guard<spinlock> lock(inject_lock_);
+			injected_.push_back(t);
+			injected_size_.fetch_add(1);
+		}
+		notify();
+	}
+
+	// One lock for the whole batch, and no more wakeups than tasks.
+	virtual void add_batch(task** tasks, size_t n) noexcept override
+	{
+		if (n == 0)
+			return;
+		auto& self = current();
+		if (self.pool == this)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				workers_[self.index]->deque.push(tasks[i]);
+			}
+		}
+		else
+		{
+			std::lock_guard<spinlock> lock(inject_lock_);
+			for (size_t i = 0; i < n; ++i)
+			{
+				injected_.push_back(tasks[i]);
+			}
+			injected_size_.fetch_add(n);
+		}
+		notify(n);
+	}
+
+private:
+	struct worker_id
+	{
+		thread_pool* pool{nullptr};
+		size_t index{0};
+	};
+
+	static worker_id& current() noexcept
+	{
+		static thread_local worker_id id;
+		return id;
+	}
+
+	void work(size_t index)
+	{
+		current() = worker_id{this, index};
+		local_executor() = this;
+
+		while (true)
+		{
+			if (auto t = find(index))
+			{
+				t->run();
+				continue;
+			}
+			if (stopped_.load())
+				break;
+			park();
+		}
+
+		local_executor() = nullptr;
+		current() = worker_id{};
+	}
+
+	task* find(size_t index) noexcept
+	{
+		task* t;
+		auto& self = *workers_[index];
+		if (self.deque.take(t))
+			return t;
+
+		auto n = workers_.size();
+		for (size_t attempt = 0; attempt < 2 * n; ++attempt)
+		{
+			auto victim = next_random(self.seed) % n;
+			if (victim != index && workers_[victim]->deque.steal(t))
+				return t;
+		}
+
+		if (injected_size_.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<spinlock> lock(inject_lock_);
+			if (!injected_.empty())
+			{
+				t = injected_.front();
+				injected_.pop_front();
+				injected_size_.fetch_sub(1);
+				return t;
+			}
+		}
+		return nullptr;
+	}
+
+	bool has_work() const noexcept
+	{
+		if (injected_size_.load())
+			return true;
+		for (auto& w : workers_)
+		{
+			if (!w->deque.empty())
+				return true;
+		}
+		return false;
+	}
+
+	// A producer either sees the sleeper count raised, or the sleeper sees
+	// the new task when it re-checks.
+	void park() noexcept
+	{
+		auto e = epoch_.load();
+		sleepers_.fetch_add(1);
+		if (!has_work() && !stopped_.load())
+			futex_wait(epoch_, e);
+		sleepers_.fetch_sub(1);
+	}
+
+	void notify(size_t n = 1) noexcept
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleepers_.load())
+		{
+			epoch_.fetch_add(1);
+			futex_wake(epoch_, int(std::min<size_t>(n, workers_.size())));
+		}
+	}
+
+	static uint64_t next_random(uint64_t& x) noexcept
+	{
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		return x;
+	}
+};
+
+} // namespace dot
@@ -0,0 +1,147 @@
+#include "thread_pool.hpp"
+#include <benchmark/benchmark.h>
+
+
+// Recursion below the cutoff runs serially, so both versions spawn the
+// same task tree.
+static constexpr int fib_n = 27;
+static constexpr int fib_cutoff = 16;
+
+static long serial_fib(int n)
+{
+	return n < 2 ? n : serial_fib(n - 1) + serial_fib(n - 2);
+}
+
+static dot::future<long> pool_fib(dot::thread_pool& pool, int n)
+{
+	if (n < fib_cutoff)
+		return dot::make_ready_future<long>(serial_fib(n));
+	auto a = dot::async(pool, [&pool, n] { return pool_fib(pool, n - 1); });
+	auto b = pool_fib(pool, n - 2);
+	return dot::when_all(std::move(a), std::move(b)).then(
+		[](auto fut) {
+			dot::future<long> x;
+			dot::future<long> y;
+			std::tie(x, y) = fut.get();
+			return x.get() + y.get();
+		}
+	);
+}
+
+static long std_fib(int n)
+{
+	if (n < fib_cutoff)
+		return serial_fib(n);
+	auto a = std::async(std::launch::async, std_fib, n - 1);
+	auto b = std_fib(n - 2);
+	return a.get() + b;
+}
+
+static void fib_thread_pool(benchmark::State& state)
+{
+	dot::thread_pool pool(state.range(0));
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(pool_fib(pool, fib_n).get());
+	}
+}
+BENCHMARK(fib_thread_pool)->DenseRange(1, std::thread::hardware_concurrency())->UseRealTime();
+
+static void fib_std_async(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(std_fib(fib_n));
+	}
+}
+BENCHMARK(fib_std_async)->UseRealTime();
+
+
+static constexpr int fan_out = 1000;
+
+static long work(int i)
+{
+	long x = i;
+	for (int j = 0; j < 1000; j++)
+	{
+		x = x * 6364136223846793005 + 1442695040888963407;
+	}
+	return x;
+}
+
+static void flat_thread_pool(benchmark::State& state)
+{
+	dot::thread_pool pool(state.range(0));
+	for (auto _ : state)
+	{
+		std::vector<dot::future<long> > futures;
+		futures.reserve(fan_out);
+		for (int i = 0; i < fan_out; i++)
+		{
+			futures.push_back(dot::async(pool, [i] { return work(i); }));
+		}
+		for (auto& f : futures)
+		{
+			benchmark::DoNotOptimize(f.get());
+		}
+	}
+}
+BENCHMARK(flat_thread_pool)->DenseRange(1, std::thread::hardware_concurrency())->UseRealTime();
+
+static void flat_std_async(benchmark::State& state)
+{
+	for (auto _ : state)
+	{
+		std::vector<std::future<long> > futures;
+		futures.reserve(fan_out);
+		for (int i = 0; i < fan_out; i++)
+		{
+			futures.push_back(std::async(std::launch::async, work, i));
+		}
+		for (auto& f : futures)
+		{
+			benchmark::DoNotOptimize(f.get());
+		}
+	}
+}
+BENCHMARK(flat_std_async)->UseRealTime();
+
+// A reply completing `Arg` promises, whose continuations run on the pool,
+// set one by one or through a promise_batch.
+template <bool Batched>
+static void complete_reply(benchmark::State& state)
+{
+	dot::thread_pool pool(2);
+	std::vector<dot::promise<int> > promises(state.range(0));
+	std::vector<dot::future<int> > results(state.range(0));
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < promises.size(); ++i)
+		{
+			promises[i] = dot::promise<int>();
+			results[i] = promises[i].get_future().then(pool, [](dot::future<int> f) { return f.get(); });
+		}
+		if (Batched)
+		{
+			dot::promise_batch batch;
+			for (size_t i = 0; i < promises.size(); ++i)
+			{
+				batch.set_value(promises[i], int(i));
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < promises.size(); ++i)
+			{
+				promises[i].set_value(int(i));
+			}
+		}
+		for (auto& f : results)
+		{
+			benchmark::DoNotOptimize(f.get());
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(complete_reply, false)->Arg(500)->UseRealTime();
+BENCHMARK_TEMPLATE(complete_reply, true)->Arg(500)->UseRealTime();
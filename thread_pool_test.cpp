@@ -0,0 +1,196 @@
+#include "gtest/gtest.h"
+#include "thread_pool.hpp"
+#include <numeric>
+
+using namespace dot;
+
+TEST(ChaseLevDequeTest, owner)
+{
+	chase_lev_deque<int> dq(2);
+	int x;
+	EXPECT_FALSE(dq.take(x));
+	for (int i = 0; i < 10; i++)
+	{
+		dq.push(i);
+	}
+	EXPECT_TRUE(dq.steal(x));
+	EXPECT_EQ(x, 0);
+	EXPECT_TRUE(dq.take(x));
+	EXPECT_EQ(x, 9);
+	for (int i = 8; i > 0; i--)
+	{
+		EXPECT_TRUE(dq.take(x));
+		EXPECT_EQ(x, i);
+	}
+	EXPECT_FALSE(dq.take(x));
+	EXPECT_TRUE(dq.empty());
+}
+
+TEST(ChaseLevDequeTest, steal_race)
+{
+	constexpr int n = 100000;
+	chase_lev_deque<int> dq(4);
+	std::atomic<bool> done{false};
+	std::atomic<long> stolen{0};
+
+	std::vector<std::thread> thieves;
+	for (int i = 0; i < 3; i++)
+	{
+		thieves.emplace_back(
+			[&] {
+				int x;
+				while (!done.load() || !dq.empty())
+				{
+					if (dq.steal(x))
+						stolen += x;
+				}
+			}
+		);
+	}
+
+	long taken = 0;
+	int x;
+	for (int i = 1; i <= n; i++)
+	{
+		dq.push(i);
+		if (i % 3 == 0 && dq.take(x))
+			taken += x;
+	}
+	while (dq.take(x))
+	{
+		taken += x;
+	}
+	done = true;
+	for (auto& t : thieves)
+	{
+		t.join();
+	}
+	EXPECT_EQ(taken + stolen, long(n) * (n + 1) / 2);
+}
+
+TEST(ThreadPoolTest, async)
+{
+	thread_pool pool(2);
+	auto f1 = async(pool, [] { return 13; });
+	auto f2 = async(pool, [] { throw std::runtime_error("error"); });
+	auto f3 = async(pool, [] {});
+	EXPECT_EQ(f1.get(), 13);
+	EXPECT_THROW(f2.get(), std::runtime_error);
+	f3.get();
+}
+
+TEST(ThreadPoolTest, flatten)
+{
+	thread_pool pool(2);
+	future<int> fut = async(pool,
+		[&pool] {
+			return async(pool, [] { return 42; });
+		}
+	);
+	EXPECT_EQ(fut.get(), 42);
+}
+
+static future<long> fib(thread_pool& pool, int n)
+{
+	if (n < 2)
+		return make_ready_future<long>(n);
+	auto a = async(pool, [&pool, n] { return fib(pool, n - 1); });
+	auto b = fib(pool, n - 2);
+	return when_all(std::move(a), std::move(b)).then(
+		[](auto fut) {
+			future<long> x;
+			future<long> y;
+			std::tie(x, y) = fut.get();
+			return x.get() + y.get();
+		}
+	);
+}
+
+TEST(ThreadPoolTest, fan_out)
+{
+	thread_pool pool(4);
+	EXPECT_EQ(fib(pool, 18).get(), 2584);
+
+	std::atomic<int> counter{0};
+	std::vector<future<> > futures;
+	for (int i = 0; i < 1000; i++)
+	{
+		futures.push_back(async(pool, [&counter] { counter++; }));
+	}
+	when_all(begin(futures), end(futures)).get();
+	EXPECT_EQ(counter, 1000);
+}
+
+TEST(ThreadPoolTest, continuation_on_pool)
+{
+	thread_pool pool(2);
+	promise<int> pr;
+	auto fut = pr.get_future();
+	auto res = async(pool,
+		[fut = std::move(fut)]() mutable {
+			return fut.then(
+				[](future<int> f) {
+					return local_executor() != nullptr;
+				}
+			);
+		}
+	);
+	std::thread([&pr] { pr.set_value(1); }).join();
+	EXPECT_TRUE(res.get());
+}
+
+TEST(ThreadPoolTest, promise_batch)
+{
+	thread_pool pool(2);
+	std::vector<promise<int> > promises(1000);
+	std::vector<future<int> > results;
+	for (auto& pr : promises)
+	{
+		results.push_back(pr.get_future().then(pool, [](future<int> f) { return f.get() + 1; }));
+	}
+	std::thread(
+		[&promises] {
+			promise_batch batch;
+			for (size_t i = 0; i < promises.size(); ++i)
+			{
+				batch.set_value(promises[i], int(i));
+			}
+		}
+	).join();
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		EXPECT_EQ(results[i].get(), int(i + 1));
+	}
+}
+
+TEST(ThreadPoolTest, map_reduce)
+{
+	thread_pool pool(4);
+	std::vector<long> v(100000);
+	std::iota(v.begin(), v.end(), 0);
+
+	auto sum = map_reduce(pool, v,
+		[](long x) {
+			return x % 7;
+		},
+		0L,
+		std::plus<long>()
+	);
+	long expected = 0;
+	for (auto x : v)
+	{
+		expected += x % 7;
+	}
+	EXPECT_EQ(sum.get(), expected);
+
+	auto mapped = dot::map(pool, v, [](long x) { return x * 2; }).get();
+	ASSERT_EQ(mapped.size(), v.size());
+	for (size_t i = 0; i < v.size(); i++)
+	{
+		EXPECT_EQ(mapped[i], v[i] * 2);
+	}
+
+	std::atomic<long> count{0};
+	parallel_for_each(pool, v, [&count](long) { count++; }).get();
+	EXPECT_EQ(count, long(v.size()));
+}
@@ -0,0 +1,277 @@
+#include "reactor.hpp"
+#include "abort.hpp"
+#include <chrono>
+#include <exception>
+
+#pragma once
+
+namespace dot
+{
+
+// The exception with_timeout() fails with when the deadline passes first.
+struct timed_out : public std::exception
+{
+	virtual const char* what() const noexcept override
+	{
+		return "timed out";
+	}
+};
+
+
+// Runs the timers armed from threads that are not reactors themselves.
+inline reactor& timer_reactor()
+{
+	static reactor_group group(1);
+	return group[0];
+}
+
+
+// Resolves a promise with the first of: the input future getting ready,
+// the deadline passing on the owner's timer wheel, or an abort of the
+// token. Whichever wins takes the others back before resolving: it
+// detaches the continuation from the input, withdraws the subscription and
+// cancels the timer, the latter by a task on the owner when called from
+// elsewhere.
+// Without an input, as for sleep(), the deadline resolves the promise
+// with a value instead of timed_out.
+//
+// References are held by the wheel while armed, the subscription, the
+// continuation on the input and, while setting up, by the creator.
+template <typename... T>
+struct timeout_link final : public timer, public abort_subscription, public pooled
+{
+	promise<T...> pr;
+	reactor* owner;
+	timer_wheel::clock::time_point deadline;
+	abort_token token;
+	future_state<T...>* input{nullptr};
+	bool watched{false};
+	std::atomic<bool> claimed{false};
+	std::atomic<uint32_t> refs{1};
+
+	timeout_link(reactor& r, timer_wheel::clock::time_point d, const abort_token& t) noexcept
+		: owner(&r),
+		  deadline(d),
+		  token(t)
+	{}
+
+	~timeout_link()
+	{
+		if (input)
+			input->release();
+	}
+
+	void add_ref() noexcept
+	{
+		refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release() noexcept
+	{
+		if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	bool claim() noexcept
+	{
+		return !claimed.exchange(true, std::memory_order_acq_rel);
+	}
+
+	void subscribe() noexcept
+	{
+		add_ref();
+		if (!token.subscribe(this))
+			on_abort();
+	}
+
+	// Arms the timer on the owner's thread, unless the race is over by then.
+	void arm() noexcept
+	{
+		if (claimed.load(std::memory_order_acquire))
+			return;
+		add_ref();
+		if (reactor::local() == owner)
+		{
+			owner->timers().arm(this, deadline);
+			return;
+		}
+		owner->schedule(make_task(
+			[this] {
+				if (claimed.load(std::memory_order_acquire))
+					release();
+				else
+					owner->timers().arm(this, deadline);
+			}
+		));
+	}
+
+	// Keeps the input's state, so that the others can detach from it. Done
+	// before the timer is armed or the token subscribed.
+	void watch(future<T...>& fut) noexcept
+	{
+		watched = true;
+		input = fut.shared_;
+		input->add_ref();
+	}
+
+	// Hands the input a continuation that can be taken back with detach().
+	void attach(future<T...>&& fut) noexcept
+	{
+		auto s = fut.shared_;
+		s->add_ref();
+		add_ref();
+		fut.on_ready(
+			[r = link_ref<timeout_link>(this)](future<T...> f) mutable {
+				if (r->claim())
+				{
+					r->withdraw_input();
+					r->unsubscribe();
+					r->disarm();
+					f.forward_to(std::move(r->pr));
+				}
+			}
+		);
+		// a winner that came first could not take it back yet
+		if (claimed.load(std::memory_order_acquire))
+			s->detach();
+		s->release();
+	}
+
+	virtual void expire() noexcept override
+	{
+		if (claim())
+		{
+			withdraw_input();
+			unsubscribe();
+			expired(std::integral_constant<bool, sizeof...(T) == 0>());
+		}
+		release();
+	}
+
+	virtual void on_abort() noexcept override
+	{
+		if (claim())
+		{
+			withdraw_input();
+			disarm();
+			pr.set_exception(abort_requested());
+		}
+		release();
+	}
+
+private:
+	void expired(std::true_type) noexcept
+	{
+		if (watched)
+			pr.set_exception(timed_out());
+		else
+			pr.set_value();
+	}
+
+	void expired(std::false_type) noexcept
+	{
+		pr.set_exception(timed_out());
+	}
+
+	// Only the winner touches `input` once set up.
+	void withdraw_input() noexcept
+	{
+		if (input)
+		{
+			input->detach();
+			std::exchange(input, nullptr)->release();
+		}
+	}
+
+	void unsubscribe() noexcept
+	{
+		if (token.unsubscribe(this))
+			release();
+	}
+
+	void disarm() noexcept
+	{
+		if (reactor::local() == owner)
+		{
+			if (armed())
+			{
+				owner->timers().cancel(this);
+				release();
+			}
+			return;
+		}
+		add_ref();
+		owner->schedule(make_task(
+			[this] {
+				if (armed())
+				{
+					owner->timers().cancel(this);
+					release();
+				}
+				release();
+			}
+		));
+	}
+};
+
+
+inline timer_wheel::clock::time_point to_steady(const timer_wheel::clock::time_point& t)
+{
+	return t;
+}
+
+template <typename Clock, typename Duration>
+inline timer_wheel::clock::time_point to_steady(const std::chrono::time_point<Clock, Duration>& t)
+{
+	return timer_wheel::clock::now() +
+		std::chrono::duration_cast<timer_wheel::clock::duration>(t - Clock::now());
+}
+
+// The reactor whose wheel times the calling thread.
+inline reactor& timer_owner()
+{
+	if (auto r = reactor::local())
+		return *r;
+	return timer_reactor();
+}
+
+
+// A future that gets ready once `duration` has passed, on the timers of
+// the calling reactor, or of timer_reactor() when called elsewhere.
+// Aborting `token` fails it with abort_requested and cancels the timer.
+template <typename Rep, typename Period>
+inline future<> sleep(const std::chrono::duration<Rep, Period>& duration,
+					  const abort_token& token = abort_token())
+{
+	auto l = new timeout_link<>(timer_owner(),
+		timer_wheel::clock::now() +
+			std::chrono::duration_cast<timer_wheel::clock::duration>(duration),
+		token);
+	auto fut = l->pr.get_future();
+	l->subscribe();
+	l->arm();
+	l->release();
+	return fut;
+}
+
+// Resolves like `fut`, unless `deadline` passes first: the result fails
+// with timed_out then, and the continuation on `fut` is taken back.
+template <typename Clock, typename Duration, typename... T>
+inline future<T...> with_timeout(const std::chrono::time_point<Clock, Duration>& deadline,
+								 future<T...>&& fut,
+								 const abort_token& token = abort_token())
+{
+	fut.set_ready();
+	if (fut.ready() || !fut.valid())
+		return std::move(fut);
+	auto l = new timeout_link<T...>(timer_owner(), to_steady(deadline), token);
+	auto res = l->pr.get_future();
+	l->watch(fut);
+	l->subscribe();
+	l->arm();
+	l->attach(std::move(fut));
+	l->release();
+	return res;
+}
+
+} // namespace dot
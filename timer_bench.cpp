@@ -0,0 +1,84 @@
+#include "timer.hpp"
+#include <benchmark/benchmark.h>
+
+
+struct noop_timer : public dot::timer
+{
+	virtual void expire() noexcept override {}
+};
+
+// Arg: number of timers in flight. Arming and cancelling one should not
+// depend on it.
+static void arm_cancel(benchmark::State& state)
+{
+	using namespace std::literals::chrono_literals;
+	auto now = dot::timer_wheel::clock::now();
+	dot::timer_wheel wheel(1ms, now);
+	std::vector<noop_timer> timers(state.range(0));
+	for (size_t i = 0; i < timers.size(); ++i)
+	{
+		wheel.arm(&timers[i], now + 1ms * (i % 100000));
+	}
+
+	size_t i = 0;
+	for (auto _ : state)
+	{
+		auto& t = timers[i++ % timers.size()];
+		auto expiry = t.expiry_;
+		wheel.cancel(&t);
+		wheel.arm(&t, now + 1ms * expiry);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(arm_cancel)->Arg(1)->Arg(1000)->Arg(1 << 20);
+
+// Arg: number of timers expiring within one second of ticks.
+static void advance(benchmark::State& state)
+{
+	using namespace std::literals::chrono_literals;
+	std::vector<noop_timer> timers(state.range(0));
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		auto now = dot::timer_wheel::clock::now();
+		dot::timer_wheel wheel(1ms, now);
+		for (size_t i = 0; i < timers.size(); ++i)
+		{
+			wheel.arm(&timers[i], now + 1ms * (i % 1000));
+		}
+		state.ResumeTiming();
+		wheel.advance(now + 1s);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(advance)->Arg(1000)->Arg(1 << 20);
+
+// A deadline on each of Arg requests that complete in time.
+static void with_timeout_completed(benchmark::State& state)
+{
+	using namespace std::literals::chrono_literals;
+	dot::reactor r;
+	std::thread t([&r] { r.run(); });
+	for (auto _ : state)
+	{
+		std::promise<void> done;
+		r.schedule(dot::make_task(
+			[&] {
+				auto deadline = std::chrono::steady_clock::now() + 10s;
+				for (int i = 0; i < state.range(0); ++i)
+				{
+					dot::promise<int> pr;
+					auto res = dot::with_timeout(deadline, pr.get_future());
+					pr.set_value(i);
+					benchmark::DoNotOptimize(res.get());
+				}
+				done.set_value();
+			}
+		));
+		done.get_future().wait();
+	}
+	r.stop();
+	t.join();
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(with_timeout_completed)->Arg(1000)->UseRealTime();
@@ -0,0 +1,200 @@
+#include "gtest/gtest.h"
+#include "timer.hpp"
+
+using namespace dot;
+using namespace std::literals::chrono_literals;
+
+struct recording_timer : public timer
+{
+	std::vector<int>* log;
+	int id;
+
+	recording_timer(std::vector<int>* l, int i) : log(l), id(i) {}
+
+	virtual void expire() noexcept override
+	{
+		log->push_back(id);
+	}
+};
+
+TEST(TimerWheelTest, expire_in_order)
+{
+	auto start = timer_wheel::clock::now();
+	timer_wheel wheel(1ms, start);
+	std::vector<int> log;
+	// within the first level, past it, and past the second one
+	std::vector<int> ticks = {5, 1, 255, 256, 300, 70000, 65536, 1000};
+	std::vector<std::unique_ptr<recording_timer> > timers;
+	for (auto t : ticks)
+	{
+		timers.push_back(std::make_unique<recording_timer>(&log, t));
+		wheel.arm(timers.back().get(), start + 1ms * t);
+	}
+	EXPECT_EQ(wheel.size(), ticks.size());
+
+	for (int now = 0; now <= 70000; now += 7)
+	{
+		wheel.advance(start + 1ms * now);
+		// nothing fires early, nothing is more than a step late
+		for (auto id : log)
+		{
+			EXPECT_LE(id, now);
+		}
+		for (auto& t : timers)
+		{
+			if (t->armed())
+				EXPECT_GT(t->id, now);
+		}
+	}
+	std::sort(ticks.begin(), ticks.end());
+	EXPECT_EQ(log, ticks);
+	EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, cancel)
+{
+	auto start = timer_wheel::clock::now();
+	timer_wheel wheel(1ms, start);
+	std::vector<int> log;
+	recording_timer a(&log, 1), b(&log, 2), c(&log, 3);
+	wheel.arm(&a, start + 10ms);
+	wheel.arm(&b, start + 10ms);
+	wheel.arm(&c, start + 100s);
+	wheel.cancel(&a);
+	wheel.cancel(&c);
+	EXPECT_FALSE(a.armed());
+	EXPECT_EQ(wheel.size(), 1);
+
+	EXPECT_EQ(wheel.next_expiry(), start + 10ms);
+	EXPECT_EQ(wheel.advance(start + 9ms), 0);
+	EXPECT_EQ(wheel.advance(start + 10ms), 1);
+	EXPECT_EQ(log, std::vector<int>({2}));
+	EXPECT_EQ(wheel.next_expiry(), timer_wheel::clock::time_point::max());
+}
+
+TEST(TimerWheelTest, beyond_horizon)
+{
+	auto start = timer_wheel::clock::now();
+	timer_wheel wheel(1s, start);
+	std::vector<int> log;
+	recording_timer t(&log, 1);
+	uint64_t horizon = timer_wheel::horizon;
+	auto deadline = start + 1s * (horizon + 1000);
+	wheel.arm(&t, deadline);
+	wheel.advance(start + 1s * horizon);
+	EXPECT_TRUE(log.empty());
+	wheel.advance(deadline);
+	EXPECT_EQ(log, std::vector<int>({1}));
+}
+
+TEST(TimerWheelTest, next_expiry_cascade)
+{
+	auto start = timer_wheel::clock::now();
+	timer_wheel wheel(1ms, start);
+	std::vector<int> log;
+	recording_timer far(&log, 300), near(&log, 330);
+	wheel.arm(&far, start + 300ms);
+	wheel.advance(start + 100ms);
+	// lands on the lowest wheel, while the earlier one is still a level up
+	wheel.arm(&near, start + 330ms);
+	EXPECT_LE(wheel.next_expiry(), start + 300ms);
+
+	// sleeping until each reported time never skips past a deadline
+	while (!wheel.empty())
+	{
+		auto next = wheel.next_expiry();
+		wheel.advance(next);
+		for (auto id : log)
+		{
+			EXPECT_EQ(start + 1ms * id, next);
+		}
+		log.clear();
+	}
+}
+
+TEST(TimerTest, sleep)
+{
+	auto start = std::chrono::steady_clock::now();
+	dot::sleep(5ms).get();
+	EXPECT_GE(std::chrono::steady_clock::now() - start, 5ms);
+}
+
+TEST(TimerTest, sleep_on_reactor)
+{
+	reactor r;
+	std::chrono::steady_clock::duration elapsed{};
+	r.schedule(make_task(
+		[&] {
+			auto start = std::chrono::steady_clock::now();
+			dot::sleep(5ms).then(
+				[&, start](future<> f) {
+					elapsed = std::chrono::steady_clock::now() - start;
+					EXPECT_EQ(reactor::local(), &r);
+					r.stop();
+				}
+			);
+		}
+	));
+	r.run();
+	EXPECT_GE(elapsed, 5ms);
+	EXPECT_TRUE(r.timers().empty());
+}
+
+TEST(TimerTest, sleep_on_reactor_cascade)
+{
+	// the second sleep lands on the lowest wheel before the first one moves
+	// down to it; the reactor must still wake up for the first
+	reactor r;
+	std::chrono::steady_clock::duration elapsed{};
+	r.schedule(make_task(
+		[&] {
+			auto start = std::chrono::steady_clock::now();
+			dot::sleep(300ms).then(
+				[&, start](future<> f) {
+					elapsed = std::chrono::steady_clock::now() - start;
+				}
+			);
+			dot::sleep(250ms).then(
+				[&](future<> f) {
+					dot::sleep(250ms).then([&](future<> f) { r.stop(); });
+				}
+			);
+		}
+	));
+	r.run();
+	// a reactor that overslept would only wake up to stop, 200ms later;
+	// leave a wide margin for a loaded machine
+	EXPECT_GE(elapsed, 300ms);
+	EXPECT_LT(elapsed, 450ms);
+}
+
+TEST(TimerTest, with_timeout)
+{
+	promise<int> late;
+	auto res = with_timeout(std::chrono::steady_clock::now() + 5ms, late.get_future());
+	EXPECT_THROW(res.get(), timed_out);
+	EXPECT_TRUE(late.abandoned());
+
+	promise<int> early;
+	res = with_timeout(std::chrono::steady_clock::now() + 1h, early.get_future());
+	early.set_value(13);
+	EXPECT_EQ(res.get(), 13);
+
+	res = with_timeout(std::chrono::system_clock::now() + 1h, make_ready_future(42));
+	EXPECT_EQ(res.get(), 42);
+}
+
+TEST(TimerTest, abort)
+{
+	abort_source as;
+	auto slept = dot::sleep(1h, as.get_token());
+	promise<> pr;
+	auto timed = with_timeout(std::chrono::steady_clock::now() + 1h, pr.get_future(), as.get_token());
+	as.request_abort();
+	EXPECT_THROW(slept.get(), abort_requested);
+	EXPECT_THROW(timed.get(), abort_requested);
+	EXPECT_TRUE(pr.abandoned());
+
+	auto already = dot::sleep(1h, as.get_token());
+	EXPECT_THROW(already.get(), abort_requested);
+}
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#pragma once
+
+namespace dot
+{
+
+// An entry of a timer_wheel. expire() runs on the thread advancing the
+// wheel, once the deadline has passed; the timer is unlinked by then.
+struct timer
+{
+	virtual ~timer() {};
+	virtual void expire() noexcept = 0;
+
+	bool armed() const noexcept
+	{
+		return slot_ != nullptr;
+	}
+
+	timer* prev_{nullptr};
+	timer* next_{nullptr};
+	timer** slot_{nullptr};
+	uint64_t expiry_{0};
+};
+
+
+// A hierarchical timer wheel: `levels` wheels of 256 slots, each slot of a
+// level spanning a whole turn of the level below. A timer goes into the
+// slot of its expiry tick on the lowest level that reaches that far, and
+// is moved down a level whenever the wheel below wraps around to it, so
+// arming and cancelling are O(1) whatever the number of timers. Deadlines
+// are rounded up to whole ticks of `resolution`.
+//
+// Not thread safe; each reactor owns one, see reactor::timers().
+class timer_wheel
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	static constexpr unsigned slot_bits = 8;
+	static constexpr unsigned slots = 1u << slot_bits;
+	static constexpr unsigned levels = 4;
+	// Timers further out are parked at the horizon and re-armed from there.
+	static constexpr uint64_t horizon = (uint64_t(1) << (slot_bits * levels)) - 1;
+
+private:
+	clock::duration resolution_;
+	clock::time_point start_;
+	uint64_t now_{0};
+	size_t size_{0};
+	std::array<size_t, levels> counts_{};
+	std::array<std::array<timer*, slots>, levels> wheel_{};
+
+public:
+	explicit timer_wheel(clock::duration resolution = std::chrono::milliseconds(1),
+						 clock::time_point start = clock::now()) noexcept
+		: resolution_(resolution),
+		  start_(start)
+	{}
+
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel& operator=(const timer_wheel&) = delete;
+
+	size_t size() const noexcept
+	{
+		return size_;
+	}
+
+	bool empty() const noexcept
+	{
+		return size_ == 0;
+	}
+
+	// A deadline that has passed already expires on the next advance().
+	void arm(timer* t, clock::time_point deadline) noexcept
+	{
+		auto since = std::max(deadline - start_, clock::duration::zero());
+		uint64_t tick = (since + resolution_ - clock::duration(1)) / resolution_;
+		t->expiry_ = std::max(tick, now_ + 1);
+		insert(t);
+		size_++;
+	}
+
+	void cancel(timer* t) noexcept
+	{
+		unlink(t);
+		size_--;
+	}
+
+	// Expires the timers due by `now`; returns how many.
+	size_t advance(clock::time_point now) noexcept
+	{
+		uint64_t target = std::max(now - start_, clock::duration::zero()) / resolution_;
+		if (size_ == 0)
+		{
+			now_ = std::max(now_, target);
+			return 0;
+		}
+
+		size_t expired = 0;
+		while (now_ < target && size_ != 0)
+		{
+			now_ = std::min(next_busy_tick(), target);
+			for (unsigned level = 1; level < levels && index(now_, level - 1) == 0; ++level)
+			{
+				auto& slot = wheel_[level][index(now_, level)];
+				while (auto t = slot)
+				{
+					unlink(t);
+					insert(t);
+				}
+			}
+
+			auto& slot = wheel_[0][index(now_, 0)];
+			while (auto t = slot)
+			{
+				unlink(t);
+				if (t->expiry_ > now_)
+				{
+					// back from the horizon
+					insert(t);
+					continue;
+				}
+				size_--;
+				expired++;
+				t->expire();
+			}
+		}
+		now_ = std::max(now_, target);
+		return expired;
+	}
+
+	// When advance() has work next: the earliest expiry on the lowest wheel,
+	// or the next time a timer moves down from the levels above, whichever
+	// comes first.
+	clock::time_point next_expiry() const noexcept
+	{
+		if (size_ == 0)
+			return clock::time_point::max();
+		auto next = size_ == counts_[0] ? clock::time_point::max() : time_of(next_busy_tick(1));
+		if (counts_[0] != 0)
+		{
+			for (uint64_t tick = now_ + 1; tick <= now_ + slots; ++tick)
+			{
+				if (wheel_[0][index(tick, 0)])
+					return std::min(next, time_of(tick));
+			}
+		}
+		return next;
+	}
+
+private:
+	static unsigned index(uint64_t tick, unsigned level) noexcept
+	{
+		return (tick >> (slot_bits * level)) & (slots - 1);
+	}
+
+	clock::time_point time_of(uint64_t tick) const noexcept
+	{
+		return start_ + resolution_ * tick;
+	}
+
+	// The next tick, or, while the lowest wheels from `level` on are empty,
+	// the next one that cascades from the first level holding timers.
+	uint64_t next_busy_tick(unsigned level = 0) const noexcept
+	{
+		while (level + 1 < levels && counts_[level] == 0)
+		{
+			level++;
+		}
+		if (level == 0)
+			return now_ + 1;
+		auto bits = slot_bits * level;
+		return ((now_ >> bits) + 1) << bits;
+	}
+
+	void insert(timer* t) noexcept
+	{
+		auto expiry = std::min(std::max(t->expiry_, now_), now_ + horizon);
+		auto delta = expiry - now_;
+		unsigned level = 0;
+		while (level + 1 < levels && delta >= (uint64_t(1) << (slot_bits * (level + 1))))
+		{
+			level++;
+		}
+		auto& slot = wheel_[level][index(expiry, level)];
+		counts_[level]++;
+		t->prev_ = nullptr;
+		t->next_ = slot;
+		if (slot)
+			slot->prev_ = t;
+		slot = t;
+		t->slot_ = &slot;
+	}
+
+	void unlink(timer* t) noexcept
+	{
+		counts_[(t->slot_ - &wheel_[0][0]) / slots]--;
+		if (t->prev_)
+			t->prev_->next_ = t->next_;
+		else
+			*t->slot_ = t->next_;
+		if (t->next_)
+			t->next_->prev_ = t->prev_;
+		t->prev_ = t->next_ = nullptr;
+		t->slot_ = nullptr;
+	}
+};
+
+} // namespace dot